@@ -0,0 +1,129 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "arena.h"
+
+/**
+ * @file
+ * Implementation of the class `table_arena`
+ */
+// ================================================================================================
+namespace {
+constexpr std::size_t CACHE_LINE = 64;
+constexpr std::size_t HUGE_PAGE = std::size_t(1) << 21; // 2 MiB
+} // namespace
+// ================================================================================================
+/**
+ * @brief
+ * Frees the storage of the arena.
+ */
+void table_arena::release()
+{
+	std::free(storage);
+	storage = nullptr;
+	base = nullptr;
+	num_tables = length = 0;
+	plane_stride = 0;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Allocates the arena for `tables` tables, each one with `table_length` values.
+ * @return true on success, false if the memory could not be allocated.
+ */
+bool table_arena::allocate(int tables, int table_length)
+{
+	if (storage != nullptr && tables == num_tables && table_length == length)
+		return true; // reuse the block, whose pages are already mapped
+	release();
+	if (tables < 1 || table_length < 1)
+		return false;
+	const std::size_t per_line = CACHE_LINE / sizeof(double);
+	const std::size_t rounded = ((table_length + per_line - 1) / per_line) * per_line;
+	const std::size_t stride = rounded + 2*ARENA_PADDING;
+	const std::size_t bytes = 2 * static_cast<std::size_t>(tables) * stride * sizeof(double);
+	std::size_t alignment = CACHE_LINE;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	if (bytes >= HUGE_PAGE)
+		alignment = HUGE_PAGE;
+#endif
+	storage = std::malloc(bytes + alignment);
+	if (storage == nullptr)
+	{
+		std::cerr << "Error: could not allocate " << bytes << " bytes for the tabulated values."
+			<< std::endl;
+		return false;
+	}
+	std::uintptr_t address = reinterpret_cast<std::uintptr_t>(storage);
+	address = (address + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+	base = reinterpret_cast<double*>(address);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	if (alignment == HUGE_PAGE) // only a hint; failure is harmless
+		madvise(base, (bytes / HUGE_PAGE) * HUGE_PAGE, MADV_HUGEPAGE);
+#endif
+	num_tables = tables;
+	length = table_length;
+	plane_stride = stride;
+	return true;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Exchanges the storage and the dimensions of two arenas.
+ */
+void table_arena::swap(table_arena& other)
+{
+	std::swap(storage, other.storage);
+	std::swap(base, other.base);
+	std::swap(num_tables, other.num_tables);
+	std::swap(length, other.length);
+	std::swap(plane_stride, other.plane_stride);
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Fills the padding of every plane with the periodic continuation of its values.
+ */
+void table_arena::wrap()
+{
+	for (int plane = 0; plane < 2*num_tables; plane++)
+	{
+		double* values = base + plane * plane_stride + ARENA_PADDING;
+		for (int k = 1; k <= ARENA_PADDING; k++)
+		{
+			values[-k] = values[(length - (k % length)) % length];
+			values[length - 1 + k] = values[(k - 1) % length];
+		}
+	}
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
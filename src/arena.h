@@ -0,0 +1,125 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <complex>
+#include <cstddef>
+
+// Number of wrap-around copies stored before and after each table (a multiple of 8)
+constexpr int ARENA_PADDING = 256;
+
+/**
+ * @brief
+ * The struct table_view gives access to a single table stored in a table_arena.
+ *
+ * @remark
+ * The real and imaginary parts are stored in separate planes `re` and `im`. The
+ * pointers refer to the value at position 0, but the planes extend ARENA_PADDING
+ * positions beyond both ends of the range [0, length), with the values continued
+ * periodically. Hence re[position] is valid for -ARENA_PADDING <= position <
+ * length + ARENA_PADDING, without any reduction of `position`.
+ */
+struct table_view
+{
+	const double* re;  // real parts
+	const double* im;  // imaginary parts
+	int length;        // number of sample points (the period)
+
+	inline int size() const {return length;}
+	// unchecked access; the caller guarantees that `position` lies in the padded range
+	inline std::complex<double> at(int position) const {return {re[position], im[position]};}
+	// access at an arbitrary position, reduced mod length
+	inline std::complex<double> get(int position) const
+	{
+		position %= length;
+		if (position < 0)
+			position += length;
+		return at(position);
+	}
+};
+
+/**
+ * @class
+ * A single allocation storing the tabulated values of all factors of the integrand
+ *
+ * @remark
+ * All tables have the same length. Each table consists of a plane of real parts
+ * followed by a plane of imaginary parts, and each plane is laid out as
+ * [ARENA_PADDING wrap-around copies | length values | ARENA_PADDING wrap-around copies],
+ * with every plane starting on a 64-byte boundary. On Linux, large arenas are aligned
+ * to huge page boundaries and the kernel is advised to back them by huge pages.
+ *
+ * Public member functions:
+ *
+ * table_arena()                   - constructs an empty arena
+ *
+ * bool allocate(tables, length)   - (re)allocates the arena for the given number of tables
+ *                                   of the given length. Returns false on failure.
+ *                                   The block is kept if the dimensions do not change.
+ *
+ * double* real(table), imag(table)
+ *                                 - pointers to the position 0 of the planes of a table,
+ *                                   to be filled with the values at positions 0...length-1
+ *
+ * void wrap()                     - fills in the wrap-around copies of all tables; it must
+ *                                   be called after the values have been stored
+ *
+ * table_view view(table)          - read access to a table
+ *
+ * void swap(other)                 - exchanges the contents of two arenas
+ *
+ */
+class table_arena
+{
+	private:
+	void* storage {nullptr};   // the allocated block
+	double* base {nullptr};    // the aligned beginning of the first plane
+	int num_tables {0};
+	int length {0};
+	std::size_t plane_stride {0}; // distance between consecutive planes, in doubles
+
+	void release();
+
+	public:
+	table_arena() = default;
+	~table_arena() {release();}
+	table_arena(const table_arena&) = delete;
+	table_arena& operator=(const table_arena&) = delete;
+
+	bool allocate(int tables, int table_length);
+	void wrap();
+	inline double* real(int table) {return base + (2*table) * plane_stride + ARENA_PADDING;}
+	inline double* imag(int table) {return base + (2*table + 1) * plane_stride + ARENA_PADDING;}
+	void swap(table_arena& other);
+	inline table_view view(int table) const
+	{
+		const double* re = base + (2*table) * plane_stride + ARENA_PADDING;
+		return table_view {re, re + plane_stride, length};
+	}
+};
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
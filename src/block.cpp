@@ -0,0 +1,296 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+
+#include <complex>
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "manifold.h"
+
+/**
+ * @file
+ * Block evaluation of the integrand, see mani_data::get_integrand_block().
+ *
+ * @remark
+ * The integrand is evaluated quad by quad over the whole block: first the positions
+ * of the tabulated values are computed for all points of the block, then the values
+ * are gathered and multiplied into the running products, which are kept as separate
+ * arrays of real and imaginary parts. This way, the complex multiplications of
+ * different points are independent and occupy the SIMD lanes. If the program is
+ * compiled for AVX2 or AVX-512 (see the CMake option M3DI_NATIVE), the tabulated
+ * values are loaded with vector gathers as well; otherwise we rely on the compiler
+ * to vectorize the arithmetic. The tables are stored as separate planes of real and
+ * imaginary parts, so each gather fetches a single part of consecutive points.
+ */
+namespace {
+// ================================================================================================
+/**
+ * @brief
+ * Stores the positions of `count` consecutive values, starting at `start` and advancing
+ * by `step` mod `S`.
+ * @return the position following the last one, i.e., the next starting position.
+ * @remark
+ * If all positions fit into the wrap-around padding of the tables (see table_arena),
+ * they are stored without reduction; this is the case for the small increments of
+ * typical triangulations.
+ */
+inline int fill_positions(int start, int step, int S, unsigned count, int* positions)
+{
+	const int shift = (step > S/2)? step - S : step; // the increment as a signed number
+	if (static_cast<long long>(std::abs(shift)) * count <= ARENA_PADDING)
+	{
+		for (unsigned k = 0; k < count; k++)
+			positions[k] = start + static_cast<int>(k) * shift;
+		int e = (start + static_cast<int>(count) * shift) % S;
+		return (e < 0)? e + S : e;
+	}
+	int e = start;
+	for (unsigned k = 0; k < count; k++)
+	{
+		positions[k] = e;
+		e += step;
+		if (e >= S)
+			e -= S;
+	}
+	return e;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Multiplies the running products (re, im) by the table values at the given positions.
+ * If `first` is true, the products are initialized with the table values instead.
+ */
+inline void multiply_block(const table_view& table, const int* positions, unsigned count,
+	double* re, double* im, bool first)
+{
+	const double* table_re = table.re;
+	const double* table_im = table.im;
+	unsigned k = 0;
+#if defined(__AVX512F__)
+	for (; k + 8 <= count; k += 8)
+	{
+		__m256i pos = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(positions + k));
+		__m512d tr = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, pos, table_re, 8);
+		__m512d ti = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, pos, table_im, 8);
+		if (first)
+		{
+			_mm512_storeu_pd(re + k, tr);
+			_mm512_storeu_pd(im + k, ti);
+			continue;
+		}
+		__m512d pr = _mm512_loadu_pd(re + k);
+		__m512d pi = _mm512_loadu_pd(im + k);
+		_mm512_storeu_pd(re + k, _mm512_sub_pd(_mm512_mul_pd(pr, tr), _mm512_mul_pd(pi, ti)));
+		_mm512_storeu_pd(im + k, _mm512_add_pd(_mm512_mul_pd(pr, ti), _mm512_mul_pd(pi, tr)));
+	}
+#endif
+#if defined(__AVX2__)
+	for (; k + 4 <= count; k += 4)
+	{
+		__m128i pos = _mm_loadu_si128(reinterpret_cast<const __m128i*>(positions + k));
+		const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+		__m256d tr = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), table_re, pos, all, 8);
+		__m256d ti = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), table_im, pos, all, 8);
+		if (first)
+		{
+			_mm256_storeu_pd(re + k, tr);
+			_mm256_storeu_pd(im + k, ti);
+			continue;
+		}
+		__m256d pr = _mm256_loadu_pd(re + k);
+		__m256d pi = _mm256_loadu_pd(im + k);
+		_mm256_storeu_pd(re + k, _mm256_sub_pd(_mm256_mul_pd(pr, tr), _mm256_mul_pd(pi, ti)));
+		_mm256_storeu_pd(im + k, _mm256_add_pd(_mm256_mul_pd(pr, ti), _mm256_mul_pd(pi, tr)));
+	}
+#endif
+	if (first)
+	{
+		for (; k < count; k++)
+		{
+			re[k] = table_re[positions[k]];
+			im[k] = table_im[positions[k]];
+		}
+		return;
+	}
+	for (; k < count; k++)
+	{
+		double tr = table_re[positions[k]];
+		double ti = table_im[positions[k]];
+		double pr = re[k], pi = im[k];
+		re[k] = pr * tr - pi * ti;
+		im[k] = pr * ti + pi * tr;
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Multiplies the running products (re, im) by the constant `value`, or initializes
+ * them with `value` if `first` is true.
+ */
+inline void scale_block(std::complex<double> value, unsigned count, double* re, double* im,
+	bool first)
+{
+	const double vr = value.real(), vi = value.imag();
+	if (first)
+	{
+		for (unsigned k = 0; k < count; k++)
+		{
+			re[k] = vr;
+			im[k] = vi;
+		}
+		return;
+	}
+	for (unsigned k = 0; k < count; k++)
+	{
+		double pr = re[k], pi = im[k];
+		re[k] = pr * vr - pi * vi;
+		im[k] = pr * vi + pi * vr;
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * The body of mani_data::get_fused_integrand_block() for W values of hbar, where W is
+ * fixed at compile time so that the loops over the values of hbar are fully vectorized;
+ * W == 0 stands for an arbitrary number `width`.
+ */
+template <int W>
+inline void fused_block(const table_view* tables, int num_quads, int width, int S,
+	int* exponents, const int* increments, unsigned count, double* re, double* im)
+{
+	const int w = (W > 0)? W : width;
+	for (int quad = 0; quad < num_quads; quad++)
+	{
+		const double* table_re = tables[quad].re;
+		const double* table_im = tables[quad].im;
+		const int step = increments[quad];
+		int e = exponents[quad];
+		for (unsigned k = 0; k < count; k++)
+		{
+			// The four arrays never overlap (__restrict is understood by GCC, Clang and MSVC)
+			const double* __restrict tr = table_re + static_cast<std::ptrdiff_t>(e) * w;
+			const double* __restrict ti = table_im + static_cast<std::ptrdiff_t>(e) * w;
+			double* __restrict pr = re + k * w;
+			double* __restrict pi = im + k * w;
+			if (quad == 0)
+			{
+				for (int j = 0; j < w; j++)
+				{
+					pr[j] = tr[j];
+					pi[j] = ti[j];
+				}
+			}
+			else
+			{
+				for (int j = 0; j < w; j++)
+				{
+					const double a = pr[j], b = pi[j];
+					pr[j] = a * tr[j] - b * ti[j];
+					pi[j] = a * ti[j] + b * tr[j];
+				}
+			}
+			e += step;
+			if (e >= S)
+				e -= S;
+		}
+		exponents[quad] = e;
+	}
+}
+// ================================================================================================
+} // namespace
+
+/**
+ * @brief
+ * Evaluates the integrand at `count` <= INTEGRAND_BLOCK consecutive points of a run.
+ * @param exponents - the (reduced) exponents of the first point, one per quad; on return,
+ *                    they are advanced to the point following the last one of the block.
+ * @param increments - the change of the exponents between consecutive points (reduced).
+ * @param re, im    - arrays receiving the real and imaginary parts of the values.
+ * @remark
+ * Unlike get_integrand_value_at(), the complex products are computed by the textbook
+ * formula, so a pole of a factor yields NaN rather than infinity in the product.
+ */
+void mani_data::get_integrand_block(int* exponents, const int* increments, unsigned count,
+	double* re, double* im) const
+{
+	if (count > INTEGRAND_BLOCK)
+		count = INTEGRAND_BLOCK;
+	const int S = tables[0].size();
+	alignas(64) int positions[INTEGRAND_BLOCK];
+	for (int quad = 0; quad < num_quads; quad++)
+	{
+		if (increments[quad] == 0) // the factor is constant along the run
+		{
+			scale_block(tables[quad].at(exponents[quad]), count, re, im, quad == 0);
+			continue;
+		}
+		exponents[quad] = fill_positions(exponents[quad], increments[quad], S, count, positions);
+		multiply_block(tables[quad], positions, count, re, im, quad == 0);
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Evaluates the integrand for all of the values of hbar given to tabulate_fused()
+ * at `count` <= INTEGRAND_BLOCK consecutive points of a run.
+ * @param exponents - the (reduced) exponents of the first point, one per quad; on return,
+ *                    they are advanced to the point following the last one of the block.
+ * @param increments - the change of the exponents between consecutive points (reduced).
+ * @param re, im    - arrays of count*fused_width() entries receiving the real and imaginary
+ *                    parts of the values; the value at the point k for the j-th value of
+ *                    hbar is stored at the index k*fused_width() + j.
+ * @remark
+ * Since the fused tables are interleaved, the values of a factor for all values of hbar
+ * are loaded from consecutive addresses, and the complex multiplications for the different
+ * values of hbar occupy the SIMD lanes. For each value of hbar, the operations are the same
+ * as in get_integrand_block(), so the results are identical.
+ */
+void mani_data::get_fused_integrand_block(int* exponents, const int* increments, unsigned count,
+	double* re, double* im) const
+{
+	if (count > INTEGRAND_BLOCK)
+		count = INTEGRAND_BLOCK;
+	const int width = static_cast<int>(fused_prefactors.size());
+	const int S = fused_tables[0].size() / width;
+	const table_view* views = fused_tables.data();
+	switch (width)
+	{
+		case 2: fused_block<2>(views, num_quads, width, S, exponents, increments, count, re, im);
+			break;
+		case 4: fused_block<4>(views, num_quads, width, S, exponents, increments, count, re, im);
+			break;
+		case 8: fused_block<8>(views, num_quads, width, S, exponents, increments, count, re, im);
+			break;
+		case 16: fused_block<16>(views, num_quads, width, S, exponents, increments, count, re, im);
+			break;
+		default: fused_block<0>(views, num_quads, width, S, exponents, increments, count, re, im);
+	}
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -0,0 +1,394 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#define M3DI_CACHE_AVAILABLE
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include "cache.h"
+#include "checkpoint.h"
+
+/**
+ * @file
+ * Implementation of the cache of tabulated factors, see cache.h
+ */
+namespace {
+// ================================================================================================
+// Identification of the table files and the size of their header. The last character
+// is the version of the format; besides, the key contains TABULATION_VERSION.
+const char TABLE_MAGIC[8] = {'M', '3', 'D', 'I', 'T', 'B', 'L', '3'};
+const char* const TABLE_PREFIX = "m3di-table-";
+const char* const TABLE_SUFFIX = ".bin";
+constexpr std::size_t TABLE_HEADER = 4096;
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief The number of doubles in a plane of a table file: the values and the wrap-around
+ * copies of a table of the given length, rounded up to a multiple of 64 bytes.
+ */
+std::size_t plane_doubles(int samples)
+{
+	const std::size_t used = static_cast<std::size_t>(samples) + 2*ARENA_PADDING;
+	return (used + 7) / 8 * 8;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief The header of a table file; the key follows it immediately
+ */
+struct table_header
+{
+	char magic[8];
+	int samples;
+	int padding;
+	unsigned key_length;
+};
+// ================================================================================================
+} // namespace
+
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Returns the directory in which m3di caches files, creating it if needed.
+ */
+std::string cache_directory()
+{
+	std::string dir;
+	if (const char* env = std::getenv("M3DI_CACHE"))
+		dir = env;
+	else if (const char* env = std::getenv("XDG_CACHE_HOME"))
+		dir = std::string(env) + "/m3di";
+	else if (const char* env = std::getenv("HOME"))
+		dir = std::string(env) + "/.cache/m3di";
+	else
+		dir = "/tmp";
+#ifdef M3DI_CACHE_AVAILABLE
+	for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1))
+	{
+		mkdir(dir.substr(0, slash).c_str(), 0755); // fails harmlessly if it exists
+		if (slash == std::string::npos)
+			break;
+	}
+#endif
+	return dir;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief 64-bit FNV-1a hash of a string, as 16 hexadecimal digits
+ */
+std::string hash_string(const std::string& text)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	for (unsigned char c : text)
+	{
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	char digits[17];
+	std::snprintf(digits, sizeof(digits), "%016llx", h);
+	return digits;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Describes the processor of the host: the machine name and, where /proc/cpuinfo exists,
+ * the model and the feature flags of the first processor listed there.
+ */
+std::string host_cpu()
+{
+	std::string description;
+#ifdef M3DI_CACHE_AVAILABLE
+	static const char* const FIELDS[] = {"vendor_id", "cpu family", "model", "model name",
+		"flags", "CPU implementer", "CPU architecture", "CPU variant", "CPU part", "Features"};
+	struct utsname system;
+	if (uname(&system) == 0)
+		description = system.machine;
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(cpuinfo, line) && !line.empty())
+	{
+		const size_t colon = line.find(':');
+		if (colon == std::string::npos)
+			continue;
+		std::string field = line.substr(0, colon);
+		field.erase(field.find_last_not_of(" \t") + 1);
+		const size_t value = line.find_first_not_of(" \t", colon + 1);
+		if (value != std::string::npos
+			&& std::find(std::begin(FIELDS), std::end(FIELDS), field) != std::end(FIELDS))
+			description += "; " + line.substr(value);
+	}
+#endif
+	return description;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Describes the compiler and the instruction set extensions enabled in this build of
+ * m3di, which may change the rounding of computed values (e.g. through contractions
+ * into FMA instructions or through a wider evaluation format).
+ */
+std::string build_identity()
+{
+	std::string identity;
+#if defined(__VERSION__)
+	identity += __VERSION__;
+#elif defined(_MSC_FULL_VER)
+	identity += "MSVC " + std::to_string(_MSC_FULL_VER);
+#endif
+#ifdef __FLT_EVAL_METHOD__
+	identity += " eval " + std::to_string(__FLT_EVAL_METHOD__);
+#endif
+#if defined(__FMA__) || defined(__ARM_FEATURE_FMA)
+	identity += " fma";
+#endif
+#ifdef __AVX__
+	identity += " avx";
+#endif
+#ifdef __AVX2__
+	identity += " avx2";
+#endif
+#ifdef __AVX512F__
+	identity += " avx512f";
+#endif
+#ifdef __FAST_MATH__
+	identity += " fast-math";
+#endif
+	return identity;
+}
+// ================================================================================================
+/**
+ * @brief Class constructor; see cache.h
+ */
+table_cache::table_cache(unsigned long long max_bytes) :
+	directory {cache_directory()}, max_bytes {max_bytes}
+{
+}
+// ------------------------------------------------------------------------------------------------
+table_cache::~table_cache()
+{
+	release();
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Describes everything that a table depends on; the numbers are written exactly
+ * @remark
+ * Tables computed by differently compiled builds or on different processors (whose
+ * mathematical library may use other instructions) can differ in the last bits. The key
+ * contains a hash of build_identity() and host_cpu(), so a cache directory shared by
+ * such builds or machines keeps their tables apart.
+ */
+std::string table_cache::key(double angle, std::complex<double> hbar, int samples,
+	tabulation_method method)
+{
+	static const std::string build = hash_string(build_identity() + "\n" + host_cpu());
+	return "angle " + hexadecimal(angle) + " hbar " + hexadecimal(hbar.real()) + " "
+		+ hexadecimal(hbar.imag()) + " samples " + std::to_string(samples) + " padding "
+		+ std::to_string(ARENA_PADDING) + " method "
+		+ tabulation_method_name(method) + " version " + std::to_string(TABULATION_VERSION)
+		+ " build " + build;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Returns the path of the file of the table with the given key
+ */
+std::string table_cache::path(const std::string& key) const
+{
+	return directory + "/" + TABLE_PREFIX + hash_string(key) + TABLE_SUFFIX;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Maps the table with the given parameters if it is in the cache.
+ * @return true if the table was found; then `view` refers to the mapped table.
+ * Files which are incomplete or belong to another key (a collision of the hashes)
+ * are ignored.
+ */
+bool table_cache::lookup(double angle, std::complex<double> hbar, int samples,
+	tabulation_method method, table_view& view)
+{
+#ifdef M3DI_CACHE_AVAILABLE
+	const std::string name = key(angle, hbar, samples, method);
+	const std::string file = path(name);
+	const std::size_t plane = plane_doubles(samples);
+	const std::size_t size = TABLE_HEADER + 2 * plane * sizeof(double);
+	const int descriptor = open(file.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		return false;
+	struct stat status;
+	void* address = MAP_FAILED;
+	if (fstat(descriptor, &status) == 0 && static_cast<std::size_t>(status.st_size) == size)
+		address = mmap(nullptr, size, PROT_READ, MAP_SHARED, descriptor, 0);
+	close(descriptor); // the mapping remains valid
+	if (address == MAP_FAILED)
+		return false;
+	const char* bytes = static_cast<const char*>(address);
+	table_header header;
+	std::memcpy(&header, bytes, sizeof(header));
+	const bool valid = std::equal(TABLE_MAGIC, TABLE_MAGIC + 8, header.magic)
+		&& header.samples == samples && header.padding == ARENA_PADDING
+		&& header.key_length == name.size() && sizeof(header) + name.size() <= TABLE_HEADER
+		&& name.compare(0, name.size(), bytes + sizeof(header), header.key_length) == 0;
+	if (!valid)
+	{
+		munmap(address, size);
+		return false;
+	}
+	mappings.push_back({address, size});
+	utime(file.c_str(), nullptr); // marks the file as recently used
+	const double* re = reinterpret_cast<const double*>(bytes + TABLE_HEADER) + ARENA_PADDING;
+	view = table_view {re, re + plane, samples};
+	return true;
+#else
+	(void) angle; (void) hbar; (void) samples; (void) method; (void) view;
+	return false;
+#endif
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Stores a computed table, including its wrap-around copies, in the cache and then
+ * evicts the least recently used tables if the cache exceeds its size limit.
+ * @remark
+ * The file is written under a temporary name, flushed to the disk and renamed. Failures are
+ * reported, but they do not affect the computation.
+ */
+void table_cache::publish(double angle, std::complex<double> hbar, int samples,
+	tabulation_method method, const table_view& view) const
+{
+#ifdef M3DI_CACHE_AVAILABLE
+	const std::string name = key(angle, hbar, samples, method);
+	const std::string file = path(name);
+	const std::string temporary = file + "." + std::to_string(getpid());
+	const std::size_t plane = plane_doubles(samples);
+	std::vector<char> header(TABLE_HEADER, 0);
+	table_header fields;
+	std::copy(TABLE_MAGIC, TABLE_MAGIC + 8, fields.magic);
+	fields.samples = samples;
+	fields.padding = ARENA_PADDING;
+	fields.key_length = static_cast<unsigned>(name.size());
+	if (sizeof(fields) + name.size() > TABLE_HEADER)
+		return;
+	std::memcpy(header.data(), &fields, sizeof(fields));
+	std::memcpy(header.data() + sizeof(fields), name.data(), name.size());
+	std::vector<double> data(2 * plane, 0.0);
+	for (int position = -ARENA_PADDING; position < samples + ARENA_PADDING; position++)
+	{
+		data[position + ARENA_PADDING] = view.re[position];
+		data[plane + position + ARENA_PADDING] = view.im[position];
+	}
+	std::FILE* stream = std::fopen(temporary.c_str(), "wb");
+	bool success = (stream != nullptr);
+	success = success && std::fwrite(header.data(), 1, header.size(), stream) == header.size();
+	success = success && std::fwrite(data.data(), sizeof(double), data.size(), stream)
+		== data.size();
+	success = success && (std::fflush(stream) == 0) && (fsync(fileno(stream)) == 0);
+	if (stream)
+		success = (std::fclose(stream) == 0) && success;
+	success = success && (std::rename(temporary.c_str(), file.c_str()) == 0);
+	if (!success)
+	{
+		std::cerr << "Warning: the table could not be stored in the cache '" << directory
+			<< "'." << std::endl;
+		std::remove(temporary.c_str());
+		return;
+	}
+	evict(file);
+#else
+	(void) angle; (void) hbar; (void) samples; (void) method; (void) view;
+#endif
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Deletes the least recently used table files, except `keep`, while the total size of
+ * the table files exceeds the limit.
+ */
+void table_cache::evict(const std::string& keep) const
+{
+#ifdef M3DI_CACHE_AVAILABLE
+	struct entry {std::string path; unsigned long long size; long long time;};
+	std::vector<entry> entries;
+	unsigned long long total = 0;
+	DIR* listing = opendir(directory.c_str());
+	if (!listing)
+		return;
+	const std::string prefix(TABLE_PREFIX), suffix(TABLE_SUFFIX);
+	for (struct dirent* item = readdir(listing); item; item = readdir(listing))
+	{
+		const std::string name(item->d_name);
+		if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix)
+			|| name.compare(name.size() - suffix.size(), suffix.size(), suffix))
+			continue;
+		struct stat status;
+		const std::string file = directory + "/" + name;
+		if (stat(file.c_str(), &status) != 0)
+			continue;
+		entries.push_back({file, static_cast<unsigned long long>(status.st_size),
+			static_cast<long long>(status.st_mtime)});
+		total += entries.back().size;
+	}
+	closedir(listing);
+	std::sort(entries.begin(), entries.end(),
+		[](const entry& a, const entry& b) {return a.time < b.time;});
+	for (const entry& oldest : entries)
+	{
+		if (total <= max_bytes)
+			break;
+		if (oldest.path == keep)
+			continue;
+		if (std::remove(oldest.path.c_str()) == 0)
+			total -= oldest.size;
+	}
+#else
+	(void) keep;
+#endif
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Unmaps all of the tables found by lookup()
+ */
+void table_cache::release()
+{
+#ifdef M3DI_CACHE_AVAILABLE
+	for (const mapping& m : mappings)
+		munmap(m.address, m.size);
+#endif
+	mappings.clear();
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
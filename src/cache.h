@@ -0,0 +1,106 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <complex>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "tabulation.h"
+
+// Returns the directory of the files cached by m3di, creating it if needed;
+// see the classes jit_kernel and table_cache
+std::string cache_directory();
+// 64-bit FNV-1a hash of a string, as 16 hexadecimal digits; used in the names of cached files
+std::string hash_string(const std::string& text);
+// Descriptions of the processor of the host and of the build of m3di, which determine
+// the exact values of the computed data; see cache.cpp
+std::string host_cpu();
+std::string build_identity();
+
+/**
+ * @class
+ * A cache of tabulated factors G_q in files, shared by all processes of m3di.
+ *
+ * @remark
+ * Every table is stored in its own file in cache_directory(), whose name is derived from
+ * a hash of the key (angle, hbar, samples, tabulation method and TABULATION_VERSION).
+ * The file consists of a header page, which contains the whole key for verification,
+ * and the planes of real and imaginary parts in the layout of a table_arena, including
+ * the wrap-around copies.
+ * A table found in the cache is mapped into memory read-only and used directly, so
+ * concurrent processes share the same physical pages and nothing is computed.
+ *
+ * New files are written under a temporary name and renamed once complete, so a file
+ * under its final name is always complete. After every new file, the least recently
+ * used files (by modification time, which is renewed by every use) are deleted until
+ * the cache fits into the size limit. A deleted file stays valid in the processes
+ * which have mapped it.
+ *
+ * Public member functions:
+ *
+ * table_cache(max_bytes)               - class constructor; max_bytes limits the total
+ *                                        size of the table files
+ *
+ * bool lookup(angle, hbar, samples, method, view)
+ *                                      - maps the table if it is cached and sets `view`
+ *                                        to it; the view stays valid until release()
+ *
+ * void publish(angle, hbar, samples, method, view)
+ *                                      - stores a computed table in the cache
+ *
+ * void release()                       - unmaps all of the tables found by lookup()
+ *
+ */
+class table_cache
+{
+	private:
+	struct mapping {void* address; std::size_t size;};
+	std::string directory;           // where the files are stored
+	unsigned long long max_bytes;    // the limit of the total size of the files
+	std::vector<mapping> mappings;   // the mapped files
+
+	static std::string key(double angle, std::complex<double> hbar, int samples,
+		tabulation_method method);
+	std::string path(const std::string& key) const;
+	void evict(const std::string& keep) const;
+
+	public:
+	table_cache(unsigned long long max_bytes);
+	~table_cache();
+	table_cache(const table_cache&) = delete;
+	table_cache& operator=(const table_cache&) = delete;
+	bool lookup(double angle, std::complex<double> hbar, int samples, tabulation_method method,
+		table_view& view);
+	void publish(double angle, std::complex<double> hbar, int samples, tabulation_method method,
+		const table_view& view) const;
+	void release();
+};
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
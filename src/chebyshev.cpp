@@ -0,0 +1,201 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include "chebyshev.h"
+#include "constants.h"
+#include "fused.h"
+
+/**
+ * @file
+ * Implementation of the adaptive Chebyshev sampling of the state integral
+ */
+
+// The numbers of Chebyshev-Lobatto points tried on a piece before it is split
+constexpr unsigned CHEBYSHEV_POINTS[] = {9, 17, 33, 65, 129, 257};
+// How many times the segment may be halved
+constexpr unsigned MAX_SPLIT_DEPTH = 5;
+
+// ================================================================================================
+/**
+ * @brief Class constructor; see chebyshev.h
+ */
+chebyshev_sampler::chebyshev_sampler(mani_data& M, std::complex<double> from,
+	std::complex<double> to, unsigned samples, double tolerance, unsigned batch) :
+	M {&M}, from {from}, to {to}, samples {samples}, tolerance {tolerance},
+	batch {std::max(1u, std::min(batch, MAX_FUSED))}
+{
+}
+// ================================================================================================
+/**
+ * @brief Returns the value of hbar at the position t in [0, 1] along the segment
+ */
+std::complex<double> chebyshev_sampler::hbar(double t) const
+{
+	return (t == 1.0)? to : from + t * (to - from);
+}
+// ================================================================================================
+/**
+ * @brief Returns the positions of the n Chebyshev-Lobatto points of the interval [a, b],
+ * from b to a.
+ * @remark
+ * The points are computed as (a+b)/2 + (b-a)/2 * sin(pi*(n-1-2j)/(2n-2)), which equals
+ * (a+b)/2 + (b-a)/2 * cos(pi*j/(n-1)) but is exactly antisymmetric. Since the quotient
+ * (n-1-2j)/(2n-2) is unchanged in floating point when n-1 and j are doubled, the points
+ * for 2n-1 include those for n bit for bit, and the results can be looked up by position.
+ * The endpoints are returned exactly, so that they agree with the neighbouring pieces.
+ */
+std::vector<double> chebyshev_sampler::nodes(double a, double b, unsigned n)
+{
+	const double mid = (a + b) / 2, half = (b - a) / 2;
+	std::vector<double> positions(n);
+	for (unsigned j = 0; j < n; j++)
+	{
+		const double x = std::sin(π * (static_cast<double>(static_cast<int>(n - 1 - 2*j))
+			/ (2.0 * (n - 1))));
+		positions[j] = mid + half * x;
+	}
+	positions.front() = b;
+	positions.back() = a;
+	return positions;
+}
+// ================================================================================================
+/**
+ * @brief Computes the integrals at those positions for which they are not known yet
+ * @return false if an integration failed
+ */
+bool chebyshev_sampler::evaluate(const std::vector<double>& positions)
+{
+	std::vector<double> missing;
+	for (double t : positions)
+		if (computed.find(t) == computed.end())
+			missing.push_back(t);
+	std::sort(missing.begin(), missing.end());
+	missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+	for (std::size_t first = 0; first < missing.size(); first += batch)
+	{
+		const std::size_t end = std::min(first + batch, missing.size());
+		std::vector< std::complex<double> > group;
+		for (std::size_t i = first; i < end; i++)
+			group.push_back(hbar(missing[i]));
+		stats S;
+		fused_integrator F(*M, group, samples);
+		std::vector< std::complex<double> > integrals = F.compute_integrals(S);
+		if (integrals.size() != group.size())
+			return false;
+		for (std::size_t i = first; i < end; i++)
+			computed[missing[i]] = integrals[i - first];
+	}
+	return true;
+}
+// ================================================================================================
+/**
+ * @brief Fits an interpolant on the part [a, b] of the segment, raising the degree and
+ * splitting the part until the error estimate is below the tolerance.
+ * @return false if an integration failed
+ */
+bool chebyshev_sampler::fit(double a, double b, unsigned depth)
+{
+	chebyshev_piece piece {hbar(a), hbar(b), {}, std::numeric_limits<double>::infinity(), false};
+	double previous = 0.0; // the error estimate for the previous number of points
+	for (unsigned n : CHEBYSHEV_POINTS)
+	{
+		const std::vector<double> positions = nodes(a, b, n);
+		if (!evaluate(positions))
+			return false;
+		std::vector< std::complex<double> > values;
+		double scale = 0.0;
+		bool finite = true;
+		for (double t : positions)
+		{
+			values.push_back(computed[t]);
+			finite = finite && std::isfinite(values.back().real())
+				&& std::isfinite(values.back().imag());
+			scale = std::max(scale, std::abs(values.back()));
+		}
+		piece.coefficients.clear();
+		if (!finite)
+			break; // a pole or a removable singularity; only splitting can help
+		// c_k = 2/(n-1) * sum'' f_j cos(pi*k*j/(n-1)), the end terms of the sum and the
+		// first and last coefficients being halved
+		const unsigned m = n - 1;
+		for (unsigned k = 0; k < n; k++)
+		{
+			std::complex<double> c = 0.0;
+			for (unsigned j = 0; j < n; j++)
+			{
+				const double weight = (j == 0 || j == m)? 0.5 : 1.0;
+				c += weight * values[j] * std::cos(π * static_cast<double>((k * j) % (2 * m)) / m);
+			}
+			c *= ((k == 0 || k == m)? 1.0 : 2.0) / m;
+			piece.coefficients.push_back(c);
+		}
+		const double tail = std::max(std::abs(piece.coefficients[m]),
+			std::abs(piece.coefficients[m - 1]));
+		piece.error_estimate = (scale > 0.0)? tail / scale : 0.0;
+		piece.converged = (piece.error_estimate <= tolerance);
+		if (piece.converged)
+			break;
+		// The coefficients of an analytic function decay geometrically, so doubling the
+		// degree roughly squares the ratio of the estimates. If that will not suffice for
+		// the highest degree, split right away rather than compute points to be discarded
+		if (n == CHEBYSHEV_POINTS[4] && depth < MAX_SPLIT_DEPTH && previous > 0.0
+			&& piece.error_estimate * (piece.error_estimate / previous) > tolerance)
+			break;
+		previous = piece.error_estimate;
+	}
+	if (!piece.converged && depth < MAX_SPLIT_DEPTH)
+	{
+		const double mid = (a + b) / 2;
+		return fit(a, mid, depth + 1) && fit(mid, b, depth + 1);
+	}
+	if (piece.coefficients.empty())
+		piece.error_estimate = std::numeric_limits<double>::infinity();
+	fitted.push_back(piece);
+	return true;
+}
+// ================================================================================================
+/**
+ * @brief Samples the segment and fits the interpolants
+ * @return false if an integration failed
+ */
+bool chebyshev_sampler::run(stats& S)
+{
+	computed.clear();
+	fitted.clear();
+	S.signal(stats::messages::begin_computation);
+	const bool success = fit(0.0, 1.0, 0);
+	S.signal(stats::messages::finish_integration);
+	if (!success)
+		std::cerr << "Error while computing integrand values." << std::endl;
+	return success;
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -0,0 +1,103 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __CHEBYSHEV_H__
+#define __CHEBYSHEV_H__
+
+#include <complex>
+#include <map>
+#include <vector>
+
+#include "manifold.h"
+#include "stats.h"
+
+/**
+ * @brief A polynomial interpolant of the state integral on a part of the segment of hbar.
+ * The value at hbar = ((1-x)*from + (1+x)*to)/2 with -1 <= x <= 1 is approximated by
+ * the sum of coefficients[k] * T_k(x), where T_k is the Chebyshev polynomial of degree k.
+ */
+struct chebyshev_piece
+{
+	std::complex<double> from, to;  // the endpoints of the part of the segment
+	std::vector< std::complex<double> > coefficients; // empty if the values are not finite
+	double error_estimate;          // estimated maximal error relative to the values
+	bool converged;                 // whether the estimate is below the tolerance
+};
+
+/**
+ * @class
+ * This class samples the state integral along a segment of values of hbar adaptively and
+ * fits a piecewise Chebyshev interpolant to the samples.
+ *
+ * @remark
+ * On each piece of the segment, the integral is computed at n = 9, 17, 33, ..., 257
+ * Chebyshev-Lobatto points x_j = cos(pi*j/(n-1)). These point sets are nested, so every
+ * doubling of the degree reuses all of the integrals computed so far. The magnitude of
+ * the last two Chebyshev coefficients, relative to the largest sampled value, estimates
+ * the interpolation error. If it exceeds the tolerance at the highest degree, or is not
+ * expected to fall below it, the piece is split in half; the halves share their
+ * endpoints and the midpoint with the samples already computed. Hence the degree is
+ * high only where the integral is hard to approximate. The new points of every step are
+ * integrated in groups of up to `batch` values of hbar by one traversal of the grid each
+ * (see fused.h).
+ *
+ * Public member functions:
+ *
+ * chebyshev_sampler(M, from, to, samples, tolerance, batch) - class constructor
+ *
+ * bool run(stats)          - samples the segment; returns false if an integration fails
+ *
+ * pieces()                 - the interpolants, ordered from `from` to `to`
+ * values()                 - the computed integrals, keyed by hbar's position in [0, 1]
+ *                            along the segment
+ * hbar(t)                  - the value of hbar at the position t
+ *
+ */
+class chebyshev_sampler
+{
+	private:
+	mani_data* M;                   // non-owning pointer to the manifold data object
+	std::complex<double> from, to;  // the endpoints of the segment of hbar
+	unsigned samples;               // number of samples per dimension of the grid
+	double tolerance;               // relative tolerance of the interpolation
+	unsigned batch;                 // how many values of hbar per traversal of the grid
+	std::map< double, std::complex<double> > computed; // integrals by position
+	std::vector<chebyshev_piece> fitted;               // the accepted interpolants
+
+	static std::vector<double> nodes(double a, double b, unsigned n);
+	bool evaluate(const std::vector<double>& positions);
+	bool fit(double a, double b, unsigned depth);
+
+	public:
+	chebyshev_sampler(mani_data& M, std::complex<double> from, std::complex<double> to,
+		unsigned samples, double tolerance, unsigned batch);
+	~chebyshev_sampler() = default;
+	bool run(stats& S);
+	inline const std::vector<chebyshev_piece>& pieces() const {return fitted;}
+	inline const std::map< double, std::complex<double> >& values() const {return computed;}
+	std::complex<double> hbar(double t) const;
+};
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
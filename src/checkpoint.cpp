@@ -0,0 +1,247 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#include <json/json.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#define M3DI_FSYNC_AVAILABLE
+#include <unistd.h>
+#endif
+
+#include "kahan.h"
+#include "checkpoint.h"
+
+/**
+ * @file
+ * Implementation of the class `checkpoint`
+ */
+namespace {
+// ================================================================================================
+// Version of the format of checkpoint files
+const int CHECKPOINT_VERSION = 1;
+} // namespace
+// ================================================================================================
+/**
+ * @brief Returns the hexadecimal floating point representation of x, such as "0x1.8p+1".
+ * Unlike the decimal representation, it is exact and is parsed back by strtod().
+ */
+std::string hexadecimal(double x)
+{
+	char buffer[64];
+	std::snprintf(buffer, sizeof(buffer), "%a", x);
+	return std::string(buffer);
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Parses a double written by hexadecimal(); returns false on malformed input
+ */
+bool parse_hexadecimal(const Json::Value& text, double& x)
+{
+	if (!text.isString())
+		return false;
+	const std::string s = text.asString();
+	char* end = nullptr;
+	x = std::strtod(s.c_str(), &end);
+	return !s.empty() && (*end == '\0');
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Compact textual form of a JSON value, used for comparisons.
+ * (Json::Value distinguishes signed and unsigned integers, while the parser
+ * always produces signed ones.)
+ */
+std::string canonical(const Json::Value& value)
+{
+	Json::StreamWriterBuilder builder;
+	builder["indentation"] = "";
+	return Json::writeString(builder, value);
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Returns a JSON array describing the sums of the given tiles. Each entry is an object
+ * with the tile number "tile" and the state of its KN accumulator "state".
+ */
+Json::Value encode_tile_sums(const std::vector<KN_accumulator>& tile_sums,
+	const std::vector<unsigned>& tiles)
+{
+	Json::Value entries(Json::arrayValue);
+	for (unsigned tile : tiles)
+	{
+		double components[4];
+		tile_sums[tile].store(components);
+		Json::Value entry, state(Json::arrayValue);
+		for (double component : components)
+			state.append(hexadecimal(component));
+		entry["tile"] = tile;
+		entry["state"] = state;
+		entries.append(entry);
+	}
+	return entries;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Reads the tile sums encoded by encode_tile_sums(). For every tile in `entries`, the
+ * corresponding entry of `tile_sums` is overwritten and the entry of `finished` is set.
+ * @return false if `entries` is malformed, or if one of its tiles is out of range
+ * or already finished; the arguments may then be partially modified.
+ */
+bool decode_tile_sums(const Json::Value& entries, std::vector<KN_accumulator>& tile_sums,
+	std::vector<bool>& finished)
+{
+	if (!entries.isArray())
+		return false;
+	for (const Json::Value& entry : entries)
+	{
+		const Json::Value& state = entry["state"];
+		double components[4];
+		bool valid = entry["tile"].isUInt() && entry["tile"].asUInt() < tile_sums.size()
+			&& !finished[entry["tile"].asUInt()] && state.isArray() && state.size() == 4;
+		for (Json::ArrayIndex i = 0; valid && i < 4; i++)
+			valid = parse_hexadecimal(state[i], components[i]);
+		if (!valid)
+			return false;
+		const unsigned tile = entry["tile"].asUInt();
+		tile_sums[tile] = KN_accumulator(components);
+		finished[tile] = true;
+	}
+	return true;
+}
+// ================================================================================================
+/**
+ * @brief
+ * Constructor of class `checkpoint`.
+ * @param filepath - the location of the checkpoint file
+ * @param computation - a description of all inputs on which the tile sums depend;
+ *                      a checkpoint is only loaded if it was saved with the same description.
+ */
+checkpoint::checkpoint(const std::string& filepath, const Json::Value& computation) :
+	path {filepath}, description {computation}
+{
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Tells whether the checkpoint file exists
+ */
+bool checkpoint::exists() const
+{
+	std::ifstream file(path, std::ifstream::in);
+	return file.good();
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Reads the saved tile sums. For every tile recorded in the file, the corresponding entry
+ * of `tile_sums` is overwritten and the entry of `finished` is set to true.
+ * @return true on success, false if the file is unreadable, malformed, or was saved
+ * by a different computation; the arguments are left unchanged in that case.
+ */
+bool checkpoint::load(std::vector<KN_accumulator>& tile_sums, std::vector<bool>& finished) const
+{
+	Json::CharReaderBuilder parser;
+	Json::Value root;
+	std::string error;
+	std::ifstream file(path, std::ifstream::in);
+	if (!file.good())
+	{
+		std::cerr << "Error: checkpoint '" << path << "' cannot be opened for reading!"
+			<< std::endl;
+		return false;
+	}
+	if (!Json::parseFromStream(parser, file, &root, &error) || !root.isObject())
+	{
+		std::cerr << "Error: checkpoint '" << path << "' is not valid JSON data!" << std::endl;
+		return false;
+	}
+	if (canonical(root["version"]) != canonical(CHECKPOINT_VERSION)
+		|| canonical(root["computation"]) != canonical(description))
+	{
+		std::cerr << "Error: checkpoint '" << path << "' belongs to a different computation!"
+			<< std::endl;
+		return false;
+	}
+	std::vector<KN_accumulator> sums = tile_sums;
+	std::vector<bool> done = finished;
+	if (!decode_tile_sums(root["tiles"], sums, done))
+	{
+		std::cerr << "Error: checkpoint '" << path << "' contains invalid tiles!" << std::endl;
+		return false;
+	}
+	tile_sums.swap(sums);
+	finished.swap(done);
+	return true;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Records the sums of the given tiles, replacing the previous content of the checkpoint.
+ * @remark
+ * The data is written to a temporary file, flushed to the disk and then renamed over
+ * the checkpoint. Since renaming is atomic, the checkpoint file is always complete.
+ * @return true on success, false if the checkpoint could not be written.
+ */
+bool checkpoint::save(const std::vector<KN_accumulator>& tile_sums,
+	const std::vector<unsigned>& tiles) const
+{
+	Json::Value root;
+	root["version"] = CHECKPOINT_VERSION;
+	root["computation"] = description;
+	root["tiles"] = encode_tile_sums(tile_sums, tiles);
+
+	Json::StreamWriterBuilder builder;
+	builder["indentation"] = "\t";
+	const std::string text = Json::writeString(builder, root) + "\n";
+#ifdef M3DI_FSYNC_AVAILABLE
+	// The process ID keeps processes writing the same checkpoint from sharing the file
+	const std::string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+#else
+	const std::string temporary = path + ".tmp";
+#endif
+	std::FILE* file = std::fopen(temporary.c_str(), "wb");
+	bool success = (file != nullptr)
+		&& (std::fwrite(text.data(), 1, text.size(), file) == text.size())
+		&& (std::fflush(file) == 0);
+#ifdef M3DI_FSYNC_AVAILABLE
+	success = success && (fsync(fileno(file)) == 0);
+#endif
+	if (file != nullptr)
+		success = (std::fclose(file) == 0) && success;
+	success = success && (std::rename(temporary.c_str(), path.c_str()) == 0);
+	if (!success)
+	{
+		std::cerr << "Error: unable to write the checkpoint '" << path << "'!" << std::endl;
+		std::remove(temporary.c_str());
+	}
+	return success;
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -0,0 +1,91 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <json/json.h>
+#include <string>
+#include <vector>
+
+#include "kahan.h"
+
+/**
+ * @class
+ * A file recording the partial sums of the finished tiles of a Riemann sum,
+ * so that an interrupted integration can be resumed.
+ *
+ * @remark
+ * The file is a JSON document containing a description of the computation, given to the
+ * constructor, and the state of the KN accumulator of every finished tile, including the
+ * compensation terms. The doubles are written as hexadecimal floating point strings, so
+ * that they are restored bit for bit. Since the tile sums are combined in tile order,
+ * a resumed integration yields exactly the same result as an uninterrupted one.
+ *
+ * The file is never overwritten in place: save() writes a temporary file next to it, whose
+ * name contains the process ID, and renames it over the checkpoint, so the checkpoint
+ * always holds a complete record.
+ *
+ * Public member functions:
+ *
+ * checkpoint(path, description)      - class constructor
+ *
+ * bool exists()                      - tells whether the checkpoint file exists
+ *
+ * bool load(tile_sums, finished)     - reads the saved tile sums into `tile_sums` and sets
+ *                                      the corresponding entries of `finished`. Returns
+ *                                      false if the file is unreadable or describes
+ *                                      another computation.
+ *
+ * bool save(tile_sums, tiles)        - records the sums of the given (finished) tiles.
+ *
+ */
+class checkpoint
+{
+	private:
+	std::string path;        // location of the checkpoint file
+	Json::Value description; // the inputs determining the tile sums
+
+	public:
+	checkpoint(const std::string& filepath, const Json::Value& computation);
+	~checkpoint() = default;
+	bool exists() const;
+	bool load(std::vector<KN_accumulator>& tile_sums, std::vector<bool>& finished) const;
+	bool save(const std::vector<KN_accumulator>& tile_sums,
+		const std::vector<unsigned>& tiles) const;
+};
+
+// Exact textual representation of doubles and its inverse; see checkpoint.cpp
+std::string hexadecimal(double x);
+bool parse_hexadecimal(const Json::Value& text, double& x);
+// Compact textual form of a JSON value, used for comparisons
+std::string canonical(const Json::Value& value);
+// Conversion of tile sums from and to JSON; see checkpoint.cpp
+Json::Value encode_tile_sums(const std::vector<KN_accumulator>& tile_sums,
+	const std::vector<unsigned>& tiles);
+bool decode_tile_sums(const Json::Value& entries, std::vector<KN_accumulator>& tile_sums,
+	std::vector<bool>& finished);
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
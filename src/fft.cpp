@@ -0,0 +1,129 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+
+#include <complex>
+#include <vector>
+
+#include "constants.h"
+#include "fft.h"
+
+/**
+ * @file
+ * Implementation of the discrete Fourier transform, see fft.h
+ */
+// ================================================================================================
+/**
+ * @brief
+ * In-place iterative radix-2 transform; the length of `data` must be a power of 2.
+ * @remark
+ * The twiddle factors are all computed directly with std::polar rather than
+ * by repeated multiplication, which keeps the rounding errors small.
+ */
+static void fft_radix2(std::vector<CC>& data, bool inverse)
+{
+	const size_t n = data.size();
+	if (n < 2)
+		return;
+	// Bit-reversal permutation
+	for (size_t i = 1, j = 0; i < n; i++)
+	{
+		size_t bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+			std::swap(data[i], data[j]);
+	}
+	// Table of twiddle factors exp(-+ 2*pi*i * k/n) for k < n/2
+	const double sign = inverse? 1.0 : -1.0;
+	std::vector<CC> twiddle(n/2);
+	for (size_t k = 0; k < n/2; k++)
+		twiddle[k] = std::polar(1.0, sign * twopi * static_cast<double>(k) / n);
+	// Butterflies
+	for (size_t len = 2; len <= n; len <<= 1)
+	{
+		const size_t stride = n / len;
+		for (size_t start = 0; start < n; start += len)
+			for (size_t k = 0; k < len/2; k++)
+			{
+				CC u = data[start + k];
+				CC v = data[start + k + len/2] * twiddle[k * stride];
+				data[start + k] = u + v;
+				data[start + k + len/2] = u - v;
+			}
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Bluestein's algorithm: expresses a transform of arbitrary length n as a cyclic
+ * convolution of length M >= 2n-1, with M a power of 2.
+ */
+static void fft_bluestein(std::vector<CC>& data, bool inverse)
+{
+	const size_t n = data.size();
+	size_t M = 1;
+	while (M < 2*n - 1)
+		M <<= 1;
+	// The chirp exp(-+ pi*i * k^2/n); k^2 is reduced mod 2n to keep the angles small
+	const double sign = inverse? 1.0 : -1.0;
+	std::vector<CC> chirp(n);
+	for (size_t k = 0; k < n; k++)
+	{
+		unsigned long long k2 = (static_cast<unsigned long long>(k) * k) % (2*n);
+		chirp[k] = std::polar(1.0, sign * π * static_cast<double>(k2) / n);
+	}
+	std::vector<CC> a(M, 0.0), b(M, 0.0);
+	for (size_t k = 0; k < n; k++)
+		a[k] = data[k] * chirp[k];
+	b[0] = std::conj(chirp[0]);
+	for (size_t k = 1; k < n; k++)
+		b[k] = b[M-k] = std::conj(chirp[k]);
+	fft_radix2(a, false);
+	fft_radix2(b, false);
+	for (size_t k = 0; k < M; k++)
+		a[k] *= b[k];
+	fft_radix2(a, true);
+	const double scale = 1.0 / static_cast<double>(M);
+	for (size_t k = 0; k < n; k++)
+		data[k] = chirp[k] * a[k] * scale;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Replaces `data` by its (unnormalized) discrete Fourier transform.
+ */
+void fft(std::vector<CC>& data, bool inverse)
+{
+	const size_t n = data.size();
+	if (n < 2)
+		return;
+	if ((n & (n-1)) == 0)
+		fft_radix2(data, inverse);
+	else
+		fft_bluestein(data, inverse);
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
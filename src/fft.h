@@ -0,0 +1,51 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __FFT_H__
+#define __FFT_H__
+
+#include <complex>
+#include <vector>
+
+using CC = std::complex<double>;
+/**
+ * @file
+ * A small self-contained implementation of the discrete Fourier transform.
+ *
+ * fft(data, inverse) replaces `data` by its discrete Fourier transform
+ *
+ *     data[m] <-- sum_k data[k] * exp(-+ 2*pi*i * m*k/n),    n = data.size(),
+ *
+ * with the sign "-" for the forward and "+" for the inverse transform.
+ * No normalization takes place, so the inverse transform of the forward
+ * transform multiplies the data by n.
+ *
+ * Lengths which are powers of 2 are handled by the iterative radix-2 algorithm;
+ * all other lengths are reduced to that case by Bluestein's chirp-z algorithm.
+ * In either case, the cost is O(n log n).
+ */
+void fft(std::vector<CC>& data, bool inverse = false);
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -0,0 +1,413 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+
+#include <iostream>
+#include <complex>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+
+#include "constants.h"
+#include "manifold.h"
+#include "fft.h"
+#include "kahan.h"
+#include "fourier.h"
+
+/**
+ * @file
+ * Implementation of the Fourier (constant-term) integration engine, see fourier.h
+ */
+namespace {
+// ================================================================================================
+/**
+ * @brief
+ * Truncated sequence of Fourier coefficients of one tabulated factor;
+ * coeff[j] is the coefficient of the mode m = lo + j, for lo <= m <= hi.
+ */
+struct mode_window
+{
+	int lo, hi;
+	std::vector<CC> coeff;
+};
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * The residues (mod S) of the partial sums of the congruences, packed into two words.
+ */
+struct state_key
+{
+	unsigned long long lo, hi;
+	bool operator==(const state_key& other) const {return lo == other.lo && hi == other.hi;}
+};
+struct state_hash
+{
+	size_t operator()(const state_key& k) const
+	{
+		return std::hash<unsigned long long>()((k.lo * 0x9E3779B97F4A7C15ULL) ^ k.hi);
+	}
+};
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * The collection of states with their accumulated products.
+ * If the number of possible states is small, they are stored in a dense array
+ * (in which case the key is a plain index in key.lo); otherwise in a hash table.
+ */
+class state_table
+{
+	private:
+	bool dense;
+	std::vector<CC> values;                // dense mode: value of each state
+	std::vector<char> used;                // dense mode: whether a state occurs
+	std::vector<unsigned long long> keys;  // dense mode: the states which occur
+	std::unordered_map<state_key, CC, state_hash> map; // sparse mode
+
+	public:
+	state_table(bool dense_mode, size_t capacity) : dense {dense_mode}
+	{
+		if (dense)
+		{
+			values.assign(capacity, 0.0);
+			used.assign(capacity, 0);
+		}
+	}
+	inline void add(state_key k, CC v)
+	{
+		if (!dense)
+		{
+			map[k] += v;
+			return;
+		}
+		if (!used[k.lo])
+		{
+			used[k.lo] = 1;
+			keys.push_back(k.lo);
+		}
+		values[k.lo] += v;
+	}
+	inline size_t size() const {return dense? keys.size() : map.size();}
+	void clear()
+	{
+		for (auto i : keys)
+		{
+			values[i] = 0.0;
+			used[i] = 0;
+		}
+		keys.clear();
+		map.clear();
+	}
+	inline void reserve(size_t n) {if (!dense) map.reserve(n);}
+	CC find(state_key k) const
+	{
+		if (dense)
+			return values[k.lo];
+		auto it = map.find(k);
+		return (it == map.end())? 0.0 : it->second;
+	}
+	template<typename F> void for_each(F f) const
+	{
+		if (dense)
+			for (auto i : keys)
+				f(state_key {i, 0}, values[i]);
+		else
+			for (const auto& state : map)
+				f(state.first, state.second);
+	}
+};
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Computes the truncated Fourier coefficients of a tabulated factor.
+ * @param shift - the table is rotated by `shift` samples before the transform, and the
+ *                coefficients are rotated back, which changes only the rounding errors
+ * @param scale - factor by which the truncation threshold is raised
+ * @return false if the tabulation contains a non-finite value (a pole).
+ */
+bool make_window(const table_view& table, int shift, double scale, mode_window& window)
+{
+	const int S = table.size();
+	std::vector<CC> data(S);
+	double peak = 0.0; // largest absolute value of the tabulated factor
+	for (int k = 0; k < S; k++)
+	{
+		data[k] = table.at((k + shift) % S);
+		peak = std::max(peak, std::abs(data[k]));
+		if (!std::isfinite(data[k].real()) || !std::isfinite(data[k].imag()))
+			return false;
+	}
+	fft(data, false);
+	double largest = 0.0;
+	for (int m = 0; m < S; m++)
+	{
+		data[m] /= static_cast<double>(S);
+		if (shift != 0)
+			data[m] *= std::polar(1.0, -twopi * ((static_cast<long long>(m) * shift) % S) / S);
+		largest = std::max(largest, std::abs(data[m]));
+	}
+	// The modes are represented by -(S-1)/2 <= m <= S/2. Coefficients below the
+	// rounding noise of the transform, which is proportional to the peak value
+	// of the factor, carry no information and are neglected as well.
+	const double threshold = scale * std::max(FOURIER_TOLERANCE * largest,
+		FOURIER_NOISE * peak * std::log2(static_cast<double>(S) + 1.0));
+	auto coefficient = [&](int m) {return data[(m < 0)? m + S : m];};
+	int lo = -(S-1)/2, hi = S/2;
+	while (lo < 0 && std::abs(coefficient(lo)) <= threshold)
+		lo++;
+	while (hi > 0 && std::abs(coefficient(hi)) <= threshold)
+		hi--;
+	window.lo = lo;
+	window.hi = hi;
+	window.coeff.resize(hi - lo + 1);
+	for (int m = lo; m <= hi; m++)
+		window.coeff[m - lo] = coefficient(m);
+	return true;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Computes the lattice sum of products of the coefficients in the given windows.
+ * @return true on success, false if the number of states exceeds the limits.
+ */
+bool lattice_sum(const mani_data& M, int S, const std::vector<mode_window>& windows, CC& result)
+{
+	const int n = M.dimension();
+	const int Q = static_cast<int>(M.num_quadrilaterals());
+	// Pack the n residues into one word if the states fit in a dense array;
+	// otherwise into two words; make sure they fit.
+	double num_states = 1.0;
+	for (int e = 0; e < n; e++)
+		num_states *= S;
+	const bool dense = (num_states <= static_cast<double>(FOURIER_MAX_DENSE));
+	const int rows_lo = dense? n : (n+1)/2;
+	{
+		double capacity = 1.0;
+		for (int e = 0; e < rows_lo; e++)
+			capacity *= S;
+		if (capacity >= static_cast<double>(std::numeric_limits<unsigned long long>::max()))
+		{
+			std::cerr << "The Fourier engine does not support this many samples "
+				"in this dimension." << std::endl;
+			return false;
+		}
+	}
+	auto pack = [&](const std::vector<int>& y)
+	{
+		state_key key {0, 0};
+		for (int e = n-1; e >= 0; e--)
+		{
+			unsigned long long& word = (e < rows_lo)? key.lo : key.hi;
+			word = word * S + y[e];
+		}
+		return key;
+	};
+	auto unpack = [&](state_key key, std::vector<int>& y)
+	{
+		for (int e = 0; e < n; e++)
+		{
+			unsigned long long& word = (e < rows_lo)? key.lo : key.hi;
+			y[e] = static_cast<int>(word % S);
+			word /= S;
+		}
+	};
+
+	// Order of the quads: narrow windows first, so that few states are created early on.
+	// The last quad should have a coefficient +-1 in some congruence; then its mode is
+	// determined by the state, and its (typically widest) window need not be scanned.
+	std::vector<int> order(Q);
+	for (int q = 0; q < Q; q++)
+		order[q] = q;
+	auto width = [&](int q) {return windows[q].hi - windows[q].lo;};
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {return width(a) < width(b);});
+	int pivot_row = -1; // row with a coefficient +-1 for the last quad
+	for (int i = Q-1; i >= 0 && pivot_row < 0; i--)
+		for (int e = 0; e < n; e++)
+			if (std::abs(M.ltd_entry(e, order[i])) == 1)
+			{
+				pivot_row = e;
+				std::rotate(order.begin() + i, order.begin() + i + 1, order.end());
+				break;
+			}
+	// Reachable ranges [reach_min, reach_max] of the congruences, using only the quads
+	// order[i], order[i+1], ..., order[Q-1]; stored at index i*n + e.
+	std::vector<long long> reach_min((Q+1)*n, 0), reach_max((Q+1)*n, 0);
+	for (int i = Q-1; i >= 0; i--)
+		for (int e = 0; e < n; e++)
+		{
+			const int q = order[i];
+			long long a = static_cast<long long>(M.ltd_entry(e, q)) * windows[q].lo;
+			long long b = static_cast<long long>(M.ltd_entry(e, q)) * windows[q].hi;
+			reach_min[i*n + e] = reach_min[(i+1)*n + e] + std::min(a, b);
+			reach_max[i*n + e] = reach_max[(i+1)*n + e] + std::max(a, b);
+		}
+	// The quads order[i+1], ..., order[Q-1] can complete the state y to zero iff
+	// this returns true.
+	auto viable = [&](const std::vector<int>& y, int i)
+	{
+		for (int e = 0; e < n; e++)
+		{
+			long long lo = reach_min[(i+1)*n + e], hi = reach_max[(i+1)*n + e];
+			if (hi - lo + 1 >= S)
+				continue;
+			long long r = (-y[e] - lo) % S;
+			if (r < 0)
+				r += S;
+			if (r > hi - lo)
+				return false;
+		}
+		return true;
+	};
+
+	// Enumerate the admissible mode vectors quad by quad
+	std::vector<int> y(n), z(n), step(n);
+	const size_t capacity = dense? static_cast<size_t>(num_states) : 0;
+	state_table states(dense, capacity), next(dense, capacity);
+	states.add(pack(std::vector<int>(n, 0)), 1.0);
+	const int last = (pivot_row < 0)? Q : Q-1; // quads handled by enumeration
+	for (int i = 0; i < last; i++)
+	{
+		const int q = order[i];
+		const mode_window& w = windows[q];
+		for (int e = 0; e < n; e++)
+		{
+			int r = M.ltd_entry(e, q) % S;
+			step[e] = (r < 0)? r + S : r;
+		}
+		next.clear();
+		next.reserve(states.size());
+		bool overflow = false;
+		states.for_each([&](state_key key, CC value)
+		{
+			if (overflow)
+				return;
+			unpack(key, y);
+			// z = y + lo * (column q of L), reduced mod S
+			for (int e = 0; e < n; e++)
+			{
+				long long r = (y[e] + static_cast<long long>(w.lo) * step[e]) % S;
+				z[e] = static_cast<int>((r < 0)? r + S : r);
+			}
+			for (int m = w.lo; m <= w.hi; m++)
+			{
+				if (viable(z, i))
+					next.add(pack(z), value * w.coeff[m - w.lo]);
+				for (int e = 0; e < n; e++)
+				{
+					z[e] += step[e];
+					if (z[e] >= S)
+						z[e] -= S;
+				}
+			}
+			overflow = (next.size() > FOURIER_MAX_STATES);
+		});
+		if (overflow)
+		{
+			std::cerr << "The Fourier engine exceeded its memory limit." << std::endl;
+			return false;
+		}
+		std::swap(states, next);
+	}
+	if (last < Q)
+	{
+		// The mode of the last quad is determined by the pivot row of each state.
+		const int q = order[Q-1];
+		const mode_window& w = windows[q];
+		const int sign = M.ltd_entry(pivot_row, q); // +1 or -1
+		KN_accumulator sum;
+		states.for_each([&](state_key key, CC value)
+		{
+			unpack(key, y);
+			int m = (-sign * y[pivot_row]) % S; // solves y + m * sign == 0 mod S
+			if (m < 0)
+				m += S;
+			if (m > S/2)
+				m -= S;
+			if (m < w.lo || m > w.hi)
+				return;
+			bool admissible = true;
+			for (int e = 0; e < n && admissible; e++)
+				admissible = ((y[e] + static_cast<long long>(m) * M.ltd_entry(e, q)) % S == 0);
+			if (admissible)
+				sum += value * w.coeff[m - w.lo];
+		});
+		result = sum;
+		return true;
+	}
+	result = states.find(pack(std::vector<int>(n, 0)));
+	return true;
+}
+// ================================================================================================
+} // namespace
+
+/**
+ * @brief
+ * Computes the normalized Riemann sum of the integrand (without the prefactor)
+ * as a truncated lattice sum of products of Fourier coefficients.
+ * @return true on success, false if the method is not applicable or cannot reach the
+ * accuracy FOURIER_ACCURACY, in which case the caller should fall back to a different
+ * engine.
+ * @remark
+ * The errors of the coefficients, i.e., the neglected modes and the rounding errors
+ * of the transform, are amplified by the other factors in the lattice sum. If the
+ * factors are large where the integrand is small, this amplification can exceed the
+ * result by many orders of magnitude, and no useful a priori bound is available. Hence
+ * the sum is computed a second time, from tables rotated by one sample and with scaled
+ * coefficients (so that the rounding errors differ) and with windows truncated at a
+ * higher threshold. The difference of the two sums serves as the error estimate.
+ */
+bool fourier_sum(const mani_data& M, int samples, std::complex<double>& result)
+{
+	const int Q = static_cast<int>(M.num_quadrilaterals());
+	std::vector<mode_window> windows(Q), check(Q);
+	for (int q = 0; q < Q; q++)
+	{
+		if (!make_window(M.table(q), 0, 1.0, windows[q])
+			|| !make_window(M.table(q), 1, FOURIER_CHECK_SCALE, check[q]))
+		{
+			result = std::complex<double>(std::numeric_limits<double>::quiet_NaN());
+			return true; // a pole on the integration cycle; the integral is not defined.
+		}
+	}
+	// Scaling the coefficients changes the rounding errors of the products and sums,
+	// which would otherwise largely coincide in both computations.
+	for (auto& w : check)
+		for (auto& c : w.coeff)
+			c *= FOURIER_CHECK_FACTOR;
+	CC estimate;
+	if (!lattice_sum(M, samples, windows, result) || !lattice_sum(M, samples, check, estimate))
+		return false;
+	estimate /= std::pow(FOURIER_CHECK_FACTOR, Q);
+	const double error = std::abs(result - estimate);
+	if (!(error <= FOURIER_ACCURACY * std::abs(result)))
+	{
+		std::cerr << "The Fourier engine cannot reach the relative accuracy "
+			<< FOURIER_ACCURACY << " for these parameters (estimated error "
+			<< error / std::abs(result) << ")." << std::endl;
+		return false;
+	}
+	return true;
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -0,0 +1,80 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __FOURIER_H__
+#define __FOURIER_H__
+
+#include <complex>
+#include <limits>
+
+#include "manifold.h"
+
+/**
+ * @file
+ * The Fourier (constant-term) integration engine.
+ *
+ * @remark
+ * Each tabulated factor of the integrand is a periodic sequence T_q[k], k mod S,
+ * and the integrand at the grid point t is the product of T_q[(L^T t)_q] over all
+ * quads q. Writing T_q[k] = sum_m c_q[m] exp(2*pi*i * m*k/S), where c_q is the
+ * normalized discrete Fourier transform of T_q, the Riemann sum over the grid
+ * becomes
+ *
+ *     S^(-n) * sum_t prod_q T_q[(L^T t)_q] = sum_{m : L m = 0 mod S} prod_q c_q[m_q],
+ *
+ * i.e., a sum over those mode vectors m which satisfy one congruence for each row
+ * of the (trimmed) LTD matrix L. Since the functions G_q are analytic in an annulus
+ * containing the sample circles, the coefficients c_q[m] decay geometrically in |m|.
+ * Hence we may truncate each c_q to the window of modes where it has not yet decayed
+ * below FOURIER_TOLERANCE times its maximum, or below the rounding noise of the
+ * transform. In the lattice sum, the errors of each factor are multiplied by the other
+ * factors, so the accuracy of this engine depends on the parameters and may be far
+ * worse than that of the direct summation; see fourier_sum() for how it is checked.
+ *
+ * The admissible mode vectors are enumerated quad by quad, keeping track of the
+ * partial sums of the congruences (the "state") and of the accumulated products.
+ * States from which the remaining quads can no longer reach a solution are pruned.
+ * The cost depends on the widths of the windows rather than on S^n, so this engine
+ * pays off when the sample count is large compared to the number of relevant modes.
+ */
+
+// Relative threshold below which Fourier coefficients are neglected
+constexpr double FOURIER_TOLERANCE = 1e-16;
+// Rounding noise of the discrete Fourier transform relative to the peak value
+constexpr double FOURIER_NOISE = 0.25 * std::numeric_limits<double>::epsilon();
+// Required relative accuracy of the result, as estimated by a second computation
+constexpr double FOURIER_ACCURACY = 1e-9;
+// Factor by which the truncation threshold is raised in the second computation
+constexpr double FOURIER_CHECK_SCALE = 16.0;
+// Factor by which the coefficients are scaled in the second computation
+constexpr double FOURIER_CHECK_FACTOR = 0.9;
+// Upper bound on the number of simultaneously tracked states
+constexpr size_t FOURIER_MAX_STATES = size_t(1) << 25;
+// If there are at most this many possible states, they are kept in a dense array
+constexpr size_t FOURIER_MAX_DENSE = size_t(1) << 22;
+
+bool fourier_sum(const mani_data& M, int samples, std::complex<double>& result);
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
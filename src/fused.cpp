@@ -0,0 +1,205 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#include <algorithm>
+#include <complex>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "integrator.h"
+#include "kahan.h"
+#include "manifold.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "fused.h"
+
+/**
+ * @file
+ * Implementation of member functions of the class `fused_integrator`
+ */
+// ================================================================================================
+/**
+ * @brief
+ * Constructor of class `fused_integrator`.
+ */
+fused_integrator::fused_integrator(mani_data& Triangulation,
+	const std::vector< std::complex<double> >& given_hbars, unsigned sam) :
+	M {&Triangulation},
+	hbars {given_hbars},
+	samples {(sam > 0)? sam : 1}
+{
+	if (hbars.size() > MAX_FUSED)
+		hbars.resize(MAX_FUSED);
+	width = static_cast<unsigned>(hbars.size());
+	nesting = M->num_tetrahedra() - M->num_cusps();
+	layout = M->grid(samples);
+	for (unsigned extent : layout.extents)
+		step_lengths.push_back(1.0/static_cast<double>(extent));
+	// The same tiles as in the class integrator, so that the results are identical
+	tile_length = integrator::tile_length_for(layout, nesting);
+	num_tiles = (layout.extents[0] + tile_length - 1) / tile_length;
+	num_threads = std::max(1u, std::min(std::thread::hardware_concurrency(), num_tiles));
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Tabulates the factors of the integrand for all values of hbar and computes the
+ * state integrals in a single traversal of the grid.
+ * @return the state integrals in the order of the values of hbar, or an empty vector
+ * if the tabulation failed.
+ */
+std::vector< std::complex<double> > fused_integrator::compute_integrals(stats& Statistics)
+{
+	std::vector< std::complex<double> > integrals;
+	if (width == 0 || !M->tabulate_fused(hbars, static_cast<int>(samples)))
+		return integrals;
+	Statistics.signal(stats::messages::finish_tabulation);
+	Statistics.set_num_threads(num_threads);
+
+	// width accumulators per tile
+	std::vector<KN_accumulator> tile_sums(static_cast<std::size_t>(num_tiles) * width);
+	std::vector<std::thread> threads(num_threads);
+	tile_scheduler scheduler(num_tiles, num_threads);
+	for (unsigned t = 0; t < num_threads; t++)
+		threads[t] = std::thread(thread_main, this, &scheduler, t, tile_sums.data());
+	for (auto& th : threads)
+	{
+		if (th.joinable())
+			th.join();
+		else
+			std::cerr << "Error: unable to join a thread!" << std::endl;
+	}
+	// Combine the tile sums in a fixed order, as integrator::grid_sum() does
+	for (unsigned j = 0; j < width; j++)
+	{
+		KN_accumulator sum;
+		for (unsigned tile = 0; tile < num_tiles; tile++)
+			sum += tile_sums[static_cast<std::size_t>(tile) * width + j];
+		integrals.push_back((step_lengths[0] * std::complex<double>(sum))
+			* M->get_fused_prefactor(j));
+	}
+	return integrals;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Computes the Riemann sums over the tile of points whose first index runs from `from`
+ * to `to`, storing the sum for the j-th value of hbar in sums[j].
+ * @remark
+ * This is integrator::odometer_sum() with `width` accumulators at every level; the values
+ * for the j-th value of hbar are passed to its accumulators in the same blocks, so that
+ * the order of all floating point operations is the same.
+ * The sums are not yet multiplied by step_lengths[0].
+ */
+void fused_integrator::tile_sum(unsigned from, unsigned to, KN_accumulator* result) const
+{
+	if (from >= to)
+		return;
+	const int S = static_cast<int>(samples);
+	const unsigned quads = M->num_quadrilaterals();
+	const unsigned last = nesting - 1; // position of the fastest-changing index
+	std::vector<unsigned> indices(nesting, 0);
+	std::vector<int> exponents(quads);
+	std::vector<KN_accumulator> sums(static_cast<std::size_t>(nesting) * width);
+
+	const std::vector<int>& increments = layout.increments;
+	auto advance = [&](unsigned level)
+	{
+		const int* row = increments.data() + (level * quads);
+		for (unsigned quad = 0; quad < quads; quad++)
+		{
+			int e = exponents[quad] + row[quad];
+			exponents[quad] = (e >= S)? e - S : e;
+		}
+	};
+	indices[0] = from;
+	for (unsigned quad = 0; quad < quads; quad++)
+		exponents[quad] = static_cast<int>((static_cast<long long>(from) * increments[quad]) % S);
+
+	const unsigned run = (last == 0)? (to - from) : layout.extents[last];
+	const int* last_row = increments.data() + (last * quads);
+	// The interleaved values of a block, and the values for a single hbar
+	alignas(64) double re[INTEGRAND_BLOCK * MAX_FUSED], im[INTEGRAND_BLOCK * MAX_FUSED];
+	alignas(64) double plane_re[INTEGRAND_BLOCK], plane_im[INTEGRAND_BLOCK];
+	for (;;)
+	{
+		KN_accumulator* run_sums = sums.data() + static_cast<std::size_t>(last) * width;
+		for (unsigned k = 0; k < run; k += INTEGRAND_BLOCK)
+		{
+			unsigned count = std::min(run - k, INTEGRAND_BLOCK);
+			M->get_fused_integrand_block(exponents.data(), last_row, count, re, im);
+			for (unsigned j = 0; j < width; j++)
+			{
+				for (unsigned i = 0; i < count; i++)
+				{
+					plane_re[i] = re[i * width + j];
+					plane_im[i] = im[i * width + j];
+				}
+				run_sums[j].add_block(plane_re, plane_im, count);
+			}
+		}
+		unsigned level = last;
+		for (; level > 0; level--)
+		{
+			KN_accumulator* inner = sums.data() + static_cast<std::size_t>(level) * width;
+			KN_accumulator* outer = inner - width;
+			for (unsigned j = 0; j < width; j++)
+			{
+				outer[j] += step_lengths[level] * std::complex<double>(inner[j]);
+				inner[j].reset();
+			}
+			unsigned parent = level - 1;
+			unsigned limit = (parent == 0)? to : layout.extents[parent];
+			if (parent == 0 && indices[0] + 1 == limit)
+				continue; // the traversal is finished; exits with level == 0
+			advance(parent);
+			if (++indices[parent] < limit)
+				break;
+			indices[parent] = 0; // this wheel wrapped around; carry on
+		}
+		if (level == 0)
+			break;
+	}
+	for (unsigned j = 0; j < width; j++)
+		result[j] = sums[j];
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * This static member function serves as the thread main for
+ * the integration threads. It processes tiles until none are left.
+ */
+void fused_integrator::thread_main(const fused_integrator* obj, tile_scheduler* scheduler,
+	unsigned worker, KN_accumulator* tile_sums)
+{
+	unsigned tile;
+	while (scheduler->acquire(worker, tile))
+	{
+		unsigned from = tile * obj->tile_length;
+		unsigned to = std::min(from + obj->tile_length, obj->layout.extents[0]);
+		obj->tile_sum(from, to, tile_sums + static_cast<std::size_t>(tile) * obj->width);
+	}
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -0,0 +1,89 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __FUSED_H__
+#define __FUSED_H__
+
+#include <complex>
+#include <vector>
+
+#include "manifold.h"
+#include "kahan.h"
+#include "scheduler.h"
+#include "stats.h"
+
+/**
+ * @class
+ * This class computes the state integrals for several values of hbar at the same number
+ * of samples in a single traversal of the sample grid.
+ *
+ * @remark
+ * The grid, its traversal and the exponents t*l(□) do not depend on hbar; only the
+ * tabulated values of the factors do. Hence the factors are tabulated for all values of
+ * hbar at once, in tables where the values for the different values of hbar at the same
+ * position are interleaved (see mani_data::tabulate_fused), and the grid is traversed
+ * only once. Every exponent is then used for all values of hbar, and the tabulated values
+ * needed at a point are loaded from consecutive addresses rather than gathered from
+ * separate tables.
+ *
+ * The traversal, the tiles and the order of the summation are the same as in the class
+ * integrator, with one KN accumulator per value of hbar, so each of the results is
+ * identical to the result of a separate computation.
+ *
+ * Public member functions:
+ *
+ * fused_integrator(M, hbars, samples)  - class constructor; at most MAX_FUSED values of hbar
+ *
+ * std::vector<std::complex<double>> compute_integrals(stats)
+ *                                      - tabulates the factors and returns the state
+ *                                        integrals, in the order of `hbars`.
+ *
+ */
+class fused_integrator
+{
+	private:
+	mani_data* M;              // non-owning pointer to the manifold data object
+	std::vector< std::complex<double> > hbars; // the values of the parameter hbar
+	unsigned samples;          // how many sample points in each coordinate direction
+	unsigned nesting;          // dimension of the integration domain
+	unsigned width;            // how many values of hbar
+	grid_layout layout;        // extents and exponent increments of the traversal
+	std::vector<double> step_lengths; // lengths of the base intervals for Riemann sums
+	unsigned tile_length;      // how many values of the first index make up a tile
+	unsigned num_tiles;        // how many tiles cover the range of the first index
+	unsigned num_threads;      // how many concurrent threads to use for the integration
+
+	void tile_sum(unsigned from, unsigned to, KN_accumulator* sums) const;
+	static void thread_main(const fused_integrator* obj, tile_scheduler* scheduler,
+		unsigned worker, KN_accumulator* tile_sums);
+
+	public:
+	fused_integrator(mani_data& M, const std::vector< std::complex<double> >& hbars,
+		unsigned samples);
+	~fused_integrator() = default;
+	std::vector< std::complex<double> > compute_integrals(stats& S);
+};
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
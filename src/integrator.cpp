@@ -5,13 +5,19 @@
  */
 
 #include <json/json.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <string>
 #include <thread>
 #include <iostream>
 
+#include "checkpoint.h"
 #include "manifold.h"
 #include "io.h"
 #include "kahan.h"
+#include "fourier.h"
+#include "scheduler.h"
 #include "stats.h"
 
 #include "integrator.h"
@@ -20,6 +26,11 @@
  * @file
  * Implementation of member functions of the class `integrator`
 */
+
+// Minimal number of sample points in a tile handed out to an integration thread
+constexpr unsigned long long MIN_TILE_POINTS = 1ULL << 14;
+// Largest number of samples per direction reached by the refinement
+constexpr unsigned long long MAX_REFINED_SAMPLES = 1ULL << 24;
 // ================================================================================================
 /**
  * @brief
@@ -27,9 +38,17 @@
  */
 integrator::integrator(mani_data& Triangulation,
 					   std::complex<double> given_hbar,
-					   unsigned sam) :
+					   unsigned sam,
+					   integration_engine given_engine,
+					   bool generated_kernel) :
 	num_threads {1},
-	hbar {given_hbar}
+	hbar {given_hbar},
+	engine {given_engine},
+	generate_kernel {generated_kernel},
+	shard_index {0},
+	shard_count {1},
+	checkpoint_interval {0.0},
+	running {0}
 {
 	if (sam < 1) sam = 1; // Make sure there's at least one sample point
 	M = &Triangulation;   // Store a pointer to the triangulation data
@@ -37,12 +56,142 @@ integrator::integrator(mani_data& Triangulation,
 	int k = M->num_cusps();
 	nesting = N-k; // N-k nested integrals
 
-	num_threads = std::thread::hardware_concurrency();
-	if (num_threads > 1)
-		samples = make_divisible(sam, num_threads);
-	else
-		samples = sam;
-	step_length = 1.0/static_cast<double>(samples);
+	samples = sam; // the sample count is honoured exactly
+	kernel = select_kernel(nesting, M->num_quadrilaterals());
+	max_threads = std::thread::hardware_concurrency();
+	if (max_threads < 1)
+		max_threads = 1;
+	set_layout(M->grid(samples));
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Sets up the traversal of the sample grid described by `given_layout`, starting at the
+ * point with all exponents equal to 0, and cuts the range of the first index into tiles.
+ */
+void integrator::set_layout(const grid_layout& given_layout)
+{
+	layout = given_layout;
+	offsets.assign(M->num_quadrilaterals(), 0);
+	step_lengths.clear();
+	for (unsigned extent : layout.extents)
+		step_lengths.push_back(1.0/static_cast<double>(extent));
+	tile_length = tile_length_for(layout, nesting);
+	num_tiles = (layout.extents[0] + tile_length - 1) / tile_length;
+	num_threads = std::min(max_threads, num_tiles);
+	jit.reset(); // a generated kernel is specific to the increments
+	reset_tiles();
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Returns the number of values of the first index making up a tile of the grid `layout`
+ * of the given dimension. (The tiles determine the order of the summation.)
+ */
+unsigned integrator::tile_length_for(const grid_layout& layout, unsigned nesting)
+{
+	// Each value of the first index stands for the points of the remaining indices;
+	// make the tiles large enough to amortize the scheduling overhead.
+	const unsigned first_extent = layout.extents[0];
+	unsigned long long points_per_index = 1;
+	for (unsigned i = 1; i < nesting && points_per_index < MIN_TILE_POINTS; i++)
+		points_per_index *= layout.extents[i];
+	unsigned length = static_cast<unsigned>(
+		(MIN_TILE_POINTS + points_per_index - 1) / points_per_index);
+	return (length > first_extent)? first_extent : length;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Clears the tile sums and marks all tiles of the shard as pending.
+ */
+void integrator::reset_tiles()
+{
+	first_tile = static_cast<unsigned>(
+		(static_cast<unsigned long long>(num_tiles) * shard_index) / shard_count);
+	end_tile = static_cast<unsigned>(
+		(static_cast<unsigned long long>(num_tiles) * (shard_index + 1)) / shard_count);
+	tile_sums.assign(num_tiles, KN_accumulator());
+	pending.clear();
+	for (unsigned tile = first_tile; tile < end_tile; tile++)
+		pending.push_back(tile);
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Splits the tiles into `count` contiguous parts of nearly equal size, and makes
+ * compute_shard() sum only the part with the given `index` (counting from 0).
+ * Must be called before set_checkpoint().
+ */
+void integrator::set_shard(unsigned index, unsigned count)
+{
+	shard_count = (count > 0)? count : 1;
+	shard_index = (index < shard_count)? index : 0;
+	reset_tiles();
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Makes compute_integral() save the sums of the finished tiles to the file `path`
+ * every `interval` seconds, and once more at the end of the summation.
+ * If `resume` is true and the file exists, the tile sums saved there are loaded,
+ * and only the remaining tiles will be summed.
+ * @return false if the file exists but cannot be resumed from.
+ */
+bool integrator::set_checkpoint(const std::string& path, bool resume, double interval)
+{
+	progress = std::make_unique<checkpoint>(path, describe_computation());
+	checkpoint_interval = interval;
+	reset_tiles();
+	if (!resume)
+		return true;
+	if (!progress->exists())
+	{
+		std::cerr << "Checkpoint '" << path << "' not found; starting from the beginning."
+			<< std::endl;
+		return true;
+	}
+	std::vector<bool> finished(num_tiles, false);
+	if (!progress->load(tile_sums, finished))
+		return false;
+	pending.erase(std::remove_if(pending.begin(), pending.end(),
+		[&finished](unsigned tile){return finished[tile];}), pending.end());
+	return true;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Describes everything that the tile sums depend on: the triangulation, hbar, the
+ * number of samples, the tiling and the tabulation. The floating point values are
+ * written exactly.
+ */
+Json::Value integrator::describe_computation() const
+{
+	Json::Value description, L(Json::arrayValue), a(Json::arrayValue);
+	const unsigned quads = M->num_quadrilaterals();
+	for (unsigned i = 0; i < nesting; i++)
+	{
+		Json::Value row(Json::arrayValue);
+		for (unsigned quad = 0; quad < quads; quad++)
+			row.append(M->ltd_entry(i, quad));
+		L.append(row);
+	}
+	for (unsigned quad = 0; quad < quads; quad++)
+		a.append(hexadecimal(M->angle(quad)));
+	description["N"] = M->num_tetrahedra();
+	description["L"] = L;
+	description["a"] = a;
+	description["hbar_real"] = hexadecimal(hbar.real());
+	description["hbar_imag"] = hexadecimal(hbar.imag());
+	description["samples"] = samples;
+	description["tile_length"] = tile_length;
+	description["num_tiles"] = num_tiles;
+	if (M->get_tabulation_method() != tabulation_method::reference)
+	{
+		// the values differ slightly from those of the untruncated products
+		description["tabulation"] = tabulation_method_name(M->get_tabulation_method());
+		description["tabulation_version"] = TABULATION_VERSION;
+	}
+	return description;
 }
 // ------------------------------------------------------------------------------------------------
 /**
@@ -52,30 +201,194 @@ integrator::integrator(mani_data& Triangulation,
  */
 std::complex<double> integrator::compute_integral(stats& Statistics)
 {
-	Statistics.set_num_threads(num_threads); // Inform stats about num_threads
 	M->tabulate(hbar, samples); // Tabulate the factors of the integrand
 	Statistics.signal(stats::messages::finish_tabulation);
 
-	// Prepare parameters needed to compute the integral
-	std::complex<double> integral {0.0};
-	unsigned samples_per_thread = samples/num_threads; // divisible by design
-	std::vector<std::thread> threads(num_threads);
-	std::vector< std::complex<double> > thread_results(num_threads);
+	if (engine == integration_engine::fourier)
+	{
+		std::complex<double> sum;
+		Statistics.set_num_threads(1);
+		if (fourier_sum(*M, samples, sum))
+			return sum * M->get_prefactor();
+		std::cerr << "Falling back to direct summation." << std::endl;
+	}
+	Statistics.set_num_threads(num_threads); // Inform stats about num_threads
 
-	// We split the integration domain between the threads:
-	for (unsigned t = 0; t < num_threads; t++)
+	// The result is the integral times the constant prefactor:
+	return grid_sum() * M->get_prefactor();
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Computes the state integral on successively finer grids until the results of two
+ * consecutive grids agree within the relative `tolerance`.
+ * @remark
+ * The grid with 2S samples per direction consists of the 2^nesting cosets t = 2s + e of
+ * the grid with S samples, where e runs over the vectors with entries 0 or 1. The coset
+ * with e = 0 is the coarse grid, whose Riemann sum is already known, and the tables of
+ * G_q for 2S consist of the tables for S at the even positions together with the values
+ * at the midpoints (see mani_data::refine_tabulation). On the coset e, the exponents are
+ * 2*L^T s + L^T e mod 2S, so the coset is traversed like the coarse grid, with doubled
+ * increments and with the offsets L^T e. Hence every point and every tabulated value is
+ * computed exactly once, and the Riemann sum for 2S is the mean of the sums over the
+ * cosets. The difference between the last two results serves as the error estimate.
+ */
+refinement_result integrator::compute_refined_integral(stats& Statistics, double tolerance)
+{
+	refinement_result result {{0.0}, samples, 0.0, false};
+	M->tabulate(hbar, samples);
+	Statistics.signal(stats::messages::finish_tabulation);
+	Statistics.set_num_threads(num_threads);
+	if (!M->ready())
+		return result;
+
+	const unsigned quads = M->num_quadrilaterals();
+	const unsigned cosets = 1u << nesting;
+	std::complex<double> coarse = grid_sum();
+	while (2ULL * samples <= MAX_REFINED_SAMPLES)
+	{
+		grid_layout refined_layout = M->grid(samples); // the coarse grid...
+		M->refine_tabulation();
+		if (!M->ready())
+			break;
+		samples *= 2;
+		for (int& increment : refined_layout.increments) // ...with doubled increments
+			increment = (2 * increment) % static_cast<int>(samples);
+		set_layout(refined_layout);
+
+		KN_accumulator sum;
+		sum += coarse;
+		for (unsigned coset = 1; coset < cosets; coset++)
+		{
+			for (unsigned quad = 0; quad < quads; quad++)
+			{
+				long long offset = 0;
+				for (unsigned i = 0; i < nesting; i++)
+					if (coset & (1u << i))
+						offset += M->ltd_entry(i, quad);
+				offset %= static_cast<long long>(samples);
+				offsets[quad] = static_cast<int>((offset < 0)? offset + samples : offset);
+			}
+			sum += grid_sum();
+		}
+		const std::complex<double> refined =
+			std::complex<double>(sum) / static_cast<double>(cosets);
+		const double difference = std::abs(refined - coarse);
+		result.error_estimate = difference * std::abs(M->get_prefactor());
+		coarse = refined;
+		if (!std::isfinite(difference)) // a pole on the grid; refining does not help
+			break;
+		if (difference <= tolerance * std::abs(refined))
+		{
+			result.converged = true;
+			break;
+		}
+	}
+	result.integral = coarse * M->get_prefactor();
+	result.samples = samples;
+	return result;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Sums the tiles of the shard, saves them in a form suitable for merging (see merge.h)
+ * and returns them together with the description of the computation, or a null value
+ * if the tabulation failed.
+ */
+Json::Value integrator::compute_shard(stats& Statistics)
+{
+	M->tabulate(hbar, samples);
+	Statistics.signal(stats::messages::finish_tabulation);
+	Statistics.set_num_threads(num_threads);
+	if (!M->ready())
+		return Json::Value();
+
+	sum_tiles();
+	const std::complex<double> prefactor = M->get_prefactor();
+	std::vector<unsigned> tiles;
+	for (unsigned tile = first_tile; tile < end_tile; tile++)
+		tiles.push_back(tile);
+	Json::Value shard;
+	shard["index"] = shard_index;
+	shard["count"] = shard_count;
+	shard["computation"] = describe_computation();
+	shard["step_length"] = hexadecimal(step_lengths[0]);
+	shard["prefactor_real"] = hexadecimal(prefactor.real());
+	shard["prefactor_imag"] = hexadecimal(prefactor.imag());
+	shard["tiles"] = encode_tile_sums(tile_sums, tiles);
+	reset_tiles();
+	return shard;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Computes the Riemann sum over the current grid layout, without the prefactor.
+ * @remark
+ * The tiles are summed by the integration threads, and the tile sums are combined
+ * in a fixed order.
+ */
+std::complex<double> integrator::grid_sum()
+{
+	sum_tiles();
+	// The tile sums are complete; we combine them in a fixed order
+	KN_accumulator sum;
+	for (const auto& tile_sum : tile_sums)
+		sum += tile_sum;
+	reset_tiles(); // the next call sums the whole grid again
+	return step_lengths[0] * std::complex<double>(sum);
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Sums the pending tiles in parallel and stores their sums in `tile_sums`.
+ * If a checkpoint is set, the finished tiles are saved periodically in the meantime.
+ */
+void integrator::sum_tiles()
+{
+	if (generate_kernel && !jit)
 	{
-		unsigned from = t     * samples_per_thread;
-		unsigned to   = (t+1) * samples_per_thread;
-		// Launch integration thread with output pointer
-		// set to t+thread_results.data()
-		threads[t] = std::thread(thread_main,
-								 this,
-								 t + thread_results.data(),
-								 from,
-								 to);
+		const int quads = static_cast<int>(M->num_quadrilaterals());
+		std::vector<int> columns(nesting * quads);
+		for (unsigned i = 0; i < nesting; i++)
+			for (int quad = 0; quad < quads; quad++)
+				columns[i*quads + quad] = M->ltd_entry(i, quad);
+		jit = std::make_unique<jit_kernel>();
+		if (!jit->load(layout.increments, columns, nesting, quads, samples))
+		{
+			std::cerr << "Falling back to the built-in integration kernels." << std::endl;
+			jit.reset();
+			generate_kernel = false;
+		}
+	}
+	kernel_data = kernel_input {&M->table(0), static_cast<int>(samples), layout.extents.data(),
+		layout.increments.data(), step_lengths.data(), offsets.data()};
+
+	const unsigned num_pending = static_cast<unsigned>(pending.size());
+	std::vector<std::thread> threads(std::min(num_threads, num_pending));
+	tile_scheduler scheduler(num_pending, static_cast<unsigned>(threads.size()));
+	std::unique_ptr<std::atomic<bool>[]> finished(new std::atomic<bool>[num_tiles]);
+	// The tiles of the shard which are not pending have been loaded from a checkpoint
+	for (unsigned tile = 0; tile < num_tiles; tile++)
+		finished[tile].store(tile >= first_tile && tile < end_tile, std::memory_order_relaxed);
+	for (unsigned tile : pending)
+		finished[tile].store(false, std::memory_order_relaxed);
+
+	// Launch the integration threads; they take tiles from the scheduler
+	running = static_cast<unsigned>(threads.size());
+	for (unsigned t = 0; t < threads.size(); t++)
+		threads[t] = std::thread(thread_main, this, &scheduler, t, finished.get());
+	// Threads are now running in parallel; meanwhile, save the checkpoints.
+	if (progress)
+	{
+		std::unique_lock<std::mutex> lock(progress_lock);
+		const std::chrono::duration<double> interval(checkpoint_interval);
+		while (!progress_signal.wait_for(lock, interval, [this]{return running == 0;}))
+		{
+			lock.unlock();
+			save_progress(finished.get());
+			lock.lock();
+		}
 	}
-	// Threads are now running in parallel.
 	for (auto& th : threads)
 	{
 		if (th.joinable())
@@ -84,76 +397,136 @@ std::complex<double> integrator::compute_integral(stats& Statistics)
 			std::cerr << "Error: unable to join a thread!" << std::endl;
 	}
 
-	// Threads are joined, we may now read the output array
-	KN_accumulator thread_sum;
-	thread_sum.accumulate(thread_results);
-	integral = thread_sum;
-
-	// The result is the integral times the constant prefactor:
-	return integral * M->get_prefactor();
+	if (progress)
+		save_progress(finished.get());
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Saves the sums of the tiles flagged in `finished` to the checkpoint.
+ * @remark
+ * May be called while the integration threads are running; a tile sum is only
+ * read after its flag has been set, which happens once the sum is complete.
+ */
+void integrator::save_progress(const std::atomic<bool>* finished)
+{
+	std::vector<unsigned> tiles;
+	for (unsigned tile = 0; tile < num_tiles; tile++)
+		if (finished[tile].load(std::memory_order_acquire))
+			tiles.push_back(tile);
+	progress->save(tile_sums, tiles);
 }
 // ------------------------------------------------------------------------------------------------
 /**
  * @brief
- *	Recursively computes a multidimensional Riemann sum over a cube of arbitrary dimension.
+ *	Computes a multidimensional Riemann sum over a cube of arbitrary dimension.
  */
 /*  Indices of sample points have the form
- *	(v[0], v[1], ..., v[size()-1], k, ...),
- *	where v = initial_indices, and k runs from 'from' to 'to'.
+ *	(k, v[1], ..., v[nesting-1]),
+ *	where k runs from 'from' to 'to' and the remaining indices run over their extents.
  *	(In general, this allows us to run over a subset of a range, as in a thread worker.)
- *	If all indices are defined (there are not "dots" at the end), this is just a plain
- *	1-dimensional Riemann sum, where k plays the role of the summation index.
- *	Otherwise, we use a recursive call (Fubini's theorem).
+ *
+ *	The indices are advanced like the wheels of an odometer, with the last index
+ *	changing fastest. The exponents t*l(□) of all quads are kept reduced mod samples
+ *	and are updated by adding a single row of increments whenever one index changes.
+ *	Since extent * increments == 0 mod samples, a wheel wrapping around from extent-1
+ *	back to 0 is handled by the very same update.
+ *
+ *	The partial sums are kept on a stack of accumulators, one per index, so that the
+ *	order of all floating point operations is the same as in the nested (Fubini)
+ *	summation. All of the working memory is allocated before the traversal begins.
+ *	The returned sum over the first index is not yet multiplied by step_lengths[0].
  */
-std::complex<double> integrator::Fubini_recursion(std::vector<unsigned>& initial_indices,
-	unsigned from, unsigned to) const
+KN_accumulator integrator::odometer_sum(unsigned from, unsigned to) const
 {
 	if (from >= to) // Nothing to compute
-		return 0.0;
+		return KN_accumulator();
 
-	// Copy initial indices
-	std::vector<unsigned> indices = initial_indices;
-	unsigned last_index = initial_indices.size();
-	indices.resize(last_index + 1); // make sure there's an extra item at the end
+	const int S = static_cast<int>(samples);
+	const unsigned quads = M->num_quadrilaterals();
+	const unsigned last = nesting - 1; // position of the fastest-changing index
+	std::vector<unsigned> indices(nesting, 0);
+	std::vector<int> exponents(quads);
+	std::vector<KN_accumulator> sums(nesting);
 
-	// Compute the Riemann sum
-	KN_accumulator sum;
-	if (last_index + 1 == nesting)
-	/*
-	 * We are iterating over the last index.
-	 * Since all indices will be known, we can actually compute the Riemann sum.
-	*/
-	{	// Loop while changing the last index
-		for (unsigned k = from; k < to; k++)
+	// Adds the row of `increments` corresponding to the index at `level`
+	const std::vector<int>& increments = layout.increments;
+	auto advance = [&](unsigned level)
+	{
+		const int* row = increments.data() + (level * quads);
+		for (unsigned quad = 0; quad < quads; quad++)
 		{
-			indices[last_index] = k;
-			sum += M->get_integrand_value(indices);
-		}	
-	}
-	else
-	/*
-		Not all indices are known yet; we must use recursion.
-	*/
-	{	// Loop while changing the last index
-		for (unsigned k = from; k < to; k++)
+			int e = exponents[quad] + row[quad];
+			exponents[quad] = (e >= S)? e - S : e;
+		}
+	};
+	// Initial point (from, 0, ..., 0)
+	indices[0] = from;
+	for (unsigned quad = 0; quad < quads; quad++)
+		exponents[quad] = static_cast<int>(
+			(offsets[quad] + static_cast<long long>(from) * increments[quad]) % S);
+
+	// Number of consecutive points in a run of the fastest-changing index
+	const unsigned run = (last == 0)? (to - from) : layout.extents[last];
+	const int* last_row = increments.data() + (last * quads);
+	alignas(64) double re[INTEGRAND_BLOCK], im[INTEGRAND_BLOCK];
+	for (;;)
+	{
+		// The values of a run are computed in blocks; this also advances the exponents.
+		KN_accumulator& sum = sums[last];
+		for (unsigned k = 0; k < run; k += INTEGRAND_BLOCK)
+		{
+			unsigned count = std::min(run - k, INTEGRAND_BLOCK);
+			M->get_integrand_block(exponents.data(), last_row, count, re, im);
+			sum.add_block(re, im, count);
+		}
+		// The run is complete; propagate the carry towards the first index.
+		unsigned level = last;
+		for (; level > 0; level--)
 		{
-			indices[last_index] = k;
-			sum += Fubini_recursion(indices, 0, samples);
-		}	
+			// Multiply the sum of values by the length of the sample interval
+			sums[level-1] += step_lengths[level] * std::complex<double>(sums[level]);
+			sums[level].reset();
+			unsigned parent = level - 1;
+			unsigned limit = (parent == 0)? to : layout.extents[parent];
+			if (parent == 0 && indices[0] + 1 == limit)
+				continue; // the traversal is finished; exits with level == 0
+			advance(parent);
+			if (++indices[parent] < limit)
+				break;
+			indices[parent] = 0; // this wheel wrapped around; carry on
+		}
+		if (level == 0)
+			break;
 	}
-	// Multiply the sum of values by the length of the sample interval
-	return step_length * std::complex<double>(sum);
+	return sums[0]; // the caller multiplies by step_lengths[0]
 }
 // ------------------------------------------------------------------------------------------------
 /**
  * This static member function serves as the thread main for
- * the integration threads.
+ * the integration threads. It processes pending tiles until none are left,
+ * setting the flag in `finished` as soon as the sum of a tile is complete.
  */
-void integrator::thread_main(integrator* obj, std::complex<double>* output,
-	 unsigned from, unsigned to)
+void integrator::thread_main(integrator* obj, tile_scheduler* scheduler, unsigned worker,
+	std::atomic<bool>* finished)
 {
-	std::vector<unsigned> empty {};
-	*output = obj->Fubini_recursion(empty, from, to);
+	KN_accumulator* tile_sums = obj->tile_sums.data();
+	unsigned index;
+	while (scheduler->acquire(worker, index))
+	{
+		const unsigned tile = obj->pending[index];
+		unsigned from = tile * obj->tile_length;
+		unsigned to = std::min(from + obj->tile_length, obj->layout.extents[0]);
+		if (obj->jit)
+			tile_sums[tile] = (*obj->jit)(obj->kernel_data, from, to);
+		else if (obj->kernel)
+			tile_sums[tile] = obj->kernel(obj->kernel_data, from, to);
+		else
+			tile_sums[tile] = obj->odometer_sum(from, to);
+		finished[tile].store(true, std::memory_order_release);
+	}
+	std::lock_guard<std::mutex> lock(obj->progress_lock);
+	obj->running--;
+	obj->progress_signal.notify_one();
 }
 // ================================================================================================
 /*
@@ -7,10 +7,21 @@
 #ifndef __INTEGRATOR_H__
 #define __INTEGRATOR_H__
 
+#include <json/json.h>
+#include <atomic>
 #include <complex>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
+#include "checkpoint.h"
 #include "manifold.h"
+#include "kahan.h"
+#include "kernels.h"
+#include "jit.h"
+#include "scheduler.h"
 #include "stats.h"
 
 /*
@@ -18,29 +29,110 @@
  *
  * This class stores the information specific to the computation of
  * the state integral for the meromorphic 3D-index and performs this
- * computation. Currently, only the quadrature via Riemann sums
- * ("rectangle rule") is implemented.
+ * computation. The quadrature is the Riemann sum ("rectangle rule") over a grid
+ * of samples^nesting points. There are two engines computing this Riemann sum:
+ * the direct summation over the grid, described below, and the Fourier engine
+ * (see fourier.h), which sums the products of Fourier coefficients of the factors.
+ *
+ * The sample grid is traversed iteratively, like an odometer, with the last index
+ * changing fastest. Rather than recomputing the exponents t*l(□) of all quads at
+ * every sample point, the traversal keeps them in a buffer and adds the appropriate
+ * row of increments whenever a single index changes. Points of the grid on which the
+ * integrand takes the same value for trivial reasons are visited only once, and the
+ * ranges of the indices shrink accordingly; see grid_layout in manifold.h.
+ *
+ * The range of the first index is cut into tiles of `tile_length` consecutive values.
+ * The tiles are handed out to the integration threads by a work-stealing scheduler,
+ * and the partial sums of the tiles are combined in a fixed order at the end.
+ * Since the tiles depend only on `samples` and the dimension, the result does not
+ * depend on the number of threads.
+ *
+ * The sums of the finished tiles may be saved periodically to a checkpoint file (see
+ * checkpoint.h), from which an interrupted integration is resumed. Only the unfinished
+ * tiles are then summed, and the result is identical to that of an uninterrupted run.
+ * Likewise, the tiles may be split into shards, which are summed by separate processes;
+ * see compute_shard() and merge.h.
+ *
+ * Instead of a fixed number of samples, the integral may also be computed on a sequence
+ * of grids, doubling the number of samples until the results agree within a given
+ * tolerance; see compute_refined_integral().
+ *
+ * For triangulations with up to 7 tetrahedra, the tiles are summed by kernels which
+ * are specialized at compile time for the dimension (see kernels.h); otherwise, the
+ * generic traversal odometer_sum() is used. Optionally, the tiles are summed by a kernel
+ * generated and compiled at run time for the actual exponent increments (see jit.h).
  *
  */
 
+enum class integration_engine {riemann, fourier};
+
+/**
+ * @brief The result of integrator::compute_refined_integral()
+ */
+struct refinement_result
+{
+	std::complex<double> integral; // the state integral on the finest grid
+	unsigned samples;              // the number of samples per direction of the finest grid
+	double error_estimate;         // the difference between the last two grids
+	bool converged;                // whether the tolerance was met
+};
+
 class integrator
 {
 private:
 	unsigned samples;          // how many sample points in each coordinate direction
 	unsigned num_threads;      // how many concurrent threads to use for the integration
+	unsigned max_threads;      // how many threads the hardware can run concurrently
 	unsigned nesting;          // dimension of the integration domain
 	mani_data* M;              // non-owning pointer to the manifold data object
 	std::complex<double> hbar; // the complex parameter of the meromorphic 3D-index
-	double step_length;        // length of the base interval for Riemann sum
+	grid_layout layout;        // extents and exponent increments of the traversal
+	std::vector<double> step_lengths; // lengths of the base intervals for Riemann sums
+	std::vector<int> offsets;  // exponents of the first grid point
+	unsigned tile_length;      // how many values of the first index make up a tile
+	unsigned num_tiles;        // how many tiles cover the range of the first index
+	integration_engine engine; // how the Riemann sum is evaluated
+	integration_kernel kernel; // specialized Riemann summation, or nullptr
+	kernel_input kernel_data;  // the arguments of `kernel`
+	bool generate_kernel;      // whether to use a kernel generated at run time
+	std::unique_ptr<jit_kernel> jit; // the generated kernel, if any
+	std::vector<KN_accumulator> tile_sums; // partial sums of the tiles
+	std::vector<unsigned> pending;   // tiles which remain to be summed
+	unsigned shard_index;            // which part of the tiles to sum...
+	unsigned shard_count;            // ...out of how many parts
+	unsigned first_tile;             // the first tile of the shard
+	unsigned end_tile;               // one past the last tile of the shard
+	std::unique_ptr<checkpoint> progress; // record of the finished tiles, or nullptr
+	double checkpoint_interval;      // seconds between two saves of the checkpoint
+	std::mutex progress_lock;        // protects `running`
+	std::condition_variable progress_signal; // notified when an integration thread exits
+	unsigned running;                // how many integration threads are still running
 public:
-	integrator(mani_data& M, std::complex<double> hbar, unsigned samples);
+	integrator(mani_data& M, std::complex<double> hbar, unsigned samples,
+		integration_engine engine = integration_engine::riemann, bool generate_kernel = false);
 	~integrator() = default;
 	std::complex<double> compute_integral(stats& S); // computes the value of the integrand
+	// computes the integral on successively finer grids, until the results agree
+	refinement_result compute_refined_integral(stats& S, double tolerance);
+	// saves the finished tiles of compute_integral() to `path` every `interval` seconds;
+	// with `resume`, the tiles already saved there are not summed again
+	bool set_checkpoint(const std::string& path, bool resume, double interval);
+	// restricts compute_shard() to the part `index` of `count` equal parts of the tiles
+	void set_shard(unsigned index, unsigned count);
+	// sums the tiles of the shard; returns the partial result for merging, or null
+	Json::Value compute_shard(stats& S);
+	// how many values of the first index make up a tile of the grid
+	static unsigned tile_length_for(const grid_layout& layout, unsigned nesting);
 private:
-	std::complex<double> Fubini_recursion(std::vector<unsigned>& initial_indices,
-		unsigned from, unsigned to) const; // performs Riemann summation recursively
-	static void thread_main(integrator* obj, std::complex<double>* output,
-		 unsigned from, unsigned to); // static member function serving as thread main.
+	void set_layout(const grid_layout& given_layout); // prepares the traversal of a grid
+	void reset_tiles(); // marks all tiles of the grid as pending
+	Json::Value describe_computation() const; // the inputs determining the tile sums
+	void save_progress(const std::atomic<bool>* finished); // saves the finished tiles
+	std::complex<double> grid_sum(); // Riemann sum over the grid, without the prefactor
+	void sum_tiles(); // sums the pending tiles
+	KN_accumulator odometer_sum(unsigned from, unsigned to) const; // Riemann summation
+	static void thread_main(integrator* obj, tile_scheduler* scheduler, unsigned worker,
+		std::atomic<bool>* finished); // static member function serving as thread main.
 };
 
 #endif
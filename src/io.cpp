@@ -5,13 +5,20 @@
  */
 
 #include <iostream>
+#include <iomanip>
+#include <sstream>
 #include <string>
+#include <vector>
 #include <cfloat>
+#include <climits>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <thread>
 #include <json/json.h>
 #include <complex>
 
+#include "manifold.h"
 #include "io.h"
 // =============================================================================================
 /**
@@ -34,19 +41,44 @@ void print_json(Json::OStream* destination, const Json::Value& data)
 	*destination << std::endl;
 }
 // =============================================================================================
+/**
+ * @brief Prints JSON data to the output stream as a single line (the JSON Lines format)
+ * @param destination - output stream to which to print data
+ * @param data - a Json::Value object containing the data
+ */
+void print_json_line(Json::OStream* destination, const Json::Value& data)
+{
+	if (!destination || !data)
+	{
+		std::cerr << "Error in JSON output!" << std::endl;
+		return;
+	}
+	Json::StreamWriterBuilder builder;
+	builder["indentation"] = "";
+	builder.settings_["precision"] = 320;
+	std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+	writer->write(data, destination);
+	*destination << std::endl; // flushes, so that every line is available immediately
+}
+// =============================================================================================
 /**
  * @brief Construct a struct `args` by parsing the command line
  */
-args::args(const char** argv)
+args::args(int argc, const char** argv) :
+	engine {"riemann"}, kernel {"builtin"}, tabulation {"product"},
+	table_cache_size {0.0}, tolerance {0.0},
+	resume {false}, checkpoint_interval {300.0}, shard_index {0}, shard_count {0}, fuse {1},
+	interpolation_tolerance {1e-8}, format {"json"}, decimation {1}
 {
 	/*
 	 * Arguments in argv and their conversions:
 	 * [0] : executable path   --> ignored
-	 * [1] : {integrate|write} --> already handled
+	 * [1] : mode              --> already handled
 	 * [2] : JSON file path    --> const char*
 	 * [3] : Re(hbar)          --> double } --> std::string (textual representation)
 	 * [4] : Im(hbar)          --> double } --> std::complex<double>
 	 * [5] : samples           --> int
+	 * [6...] : options of the form "--name value", see parse_options()
 	 */
 	double Rehbar = parse_double(argv[3]);
 	double Imhbar = parse_double(argv[4]);
@@ -54,7 +86,381 @@ args::args(const char** argv)
 	hbar_textual = format_complex_strings(argv[3], argv[4]);
 	samples = parse_int(argv[5]);
 	filepath = argv[2];
-	valid = is_valid_q_S(Rehbar, samples);
+	if (std::string(argv[1]) == "sweep")
+	{
+		// [3] and [4] are lists or ranges of values; the sweep covers all combinations
+		valid = parse_values(argv[3], re_values) && parse_values(argv[4], im_values);
+		for (std::size_t i = 0; valid && i < re_values.size(); i++)
+			valid = is_valid_q_S(re_values[i], samples);
+		if (valid)
+			set_hbar(re_values[0], im_values[0]);
+		valid = valid && parse_options(argc, argv);
+		return;
+	}
+	if (std::string(argv[1]) == "interpolate")
+	{
+		// [3] and [4] are segments "from:to" (or single numbers) of the real and imaginary
+		// parts; as Re(hbar) < 0 at both endpoints, it is negative along the whole segment
+		valid = parse_segment(argv[3], re_values) && parse_segment(argv[4], im_values)
+			&& is_valid_q_S(re_values[0], samples) && is_valid_q_S(re_values[1], samples);
+		if (valid && re_values[0] == re_values[1] && im_values[0] == im_values[1])
+		{
+			std::cerr << "Error: the endpoints of the segment of hbar coincide!" << std::endl;
+			valid = false;
+		}
+		if (valid)
+		{
+			set_hbar(re_values[0], im_values[0]);
+			hbar_textual += " to " + format_complex_strings(format_double(re_values[1]).c_str(),
+				format_double(im_values[1]).c_str());
+		}
+		fuse = 8;
+		valid = valid && parse_options(argc, argv);
+		return;
+	}
+	valid = is_valid_q_S(Rehbar, samples) && parse_options(argc, argv);
+}
+// =============================================================================================
+/**
+ * @brief Sets the value of hbar, e.g., to a point of a sweep
+ */
+void args::set_hbar(double Rehbar, double Imhbar)
+{
+	hbar = std::complex<double> {Rehbar, Imhbar};
+	hbar_textual = format_complex_strings(format_double(Rehbar).c_str(),
+		format_double(Imhbar).c_str());
+}
+// =============================================================================================
+/**
+ * @brief Parses the optional parameters following the positional ones on the command line.
+ * Each option has the form "--name value". The options which were given are also recorded
+ * in the member `options`, so that they can be reported together with the other input.
+ * @return true on success, false on an invalid or unknown option.
+ */
+bool args::parse_options(int argc, const char** argv)
+{
+	const std::string mode(argv[1]);
+	const bool integrating = (mode == "integrate" || mode == "sweep");
+	for (int i = 6; i < argc; i += 2)
+	{
+		const std::string name(argv[i]);
+		if (name.compare(0, 2, "--") != 0 || name.size() < 3)
+		{
+			std::cerr << "Error: unexpected parameter '" << name << "'!" << std::endl;
+			return false;
+		}
+		if (i+1 >= argc)
+		{
+			std::cerr << "Error: the option '" << name << "' requires a value!" << std::endl;
+			return false;
+		}
+		const std::string value(argv[i+1]);
+		if (name == "--engine" && integrating)
+		{
+			if (value != "riemann" && value != "fourier")
+			{
+				std::cerr << "Error: unknown integration engine '" << value
+					<< "'; the available engines are 'riemann' and 'fourier'." << std::endl;
+				return false;
+			}
+			engine = value;
+		}
+		else if (name == "--kernel" && integrating)
+		{
+			if (value != "builtin" && value != "jit")
+			{
+				std::cerr << "Error: unknown integration kernel '" << value
+					<< "'; the available kernels are 'builtin' and 'jit'." << std::endl;
+				return false;
+			}
+			kernel = value;
+		}
+		else if (name == "--tabulation")
+		{
+			if (value != "product" && value != "reference" && value != "fft")
+			{
+				std::cerr << "Error: unknown tabulation method '" << value
+					<< "'; the available methods are 'product', 'reference' and 'fft'."
+					<< std::endl;
+				return false;
+			}
+			tabulation = value;
+		}
+		else if (name == "--table-cache")
+		{
+			table_cache_size = parse_double(value.c_str());
+			if (!(table_cache_size > 0.0))
+			{
+				std::cerr << "Error: the size of the table cache must be a positive number "
+					"of megabytes!" << std::endl;
+				return false;
+			}
+		}
+		else if (name == "--tol" && integrating)
+		{
+			tolerance = parse_double(value.c_str());
+			if (!(tolerance > 0.0))
+			{
+				std::cerr << "Error: the tolerance must be a positive number!" << std::endl;
+				return false;
+			}
+		}
+		else if ((name == "--checkpoint" || name == "--resume") && mode == "integrate")
+		{
+			if (!checkpoint_path.empty())
+			{
+				std::cerr << "Error: only one of the options '--checkpoint' and '--resume' "
+					"may be given!" << std::endl;
+				return false;
+			}
+			checkpoint_path = value;
+			resume = (name == "--resume");
+		}
+		else if (name == "--checkpoint-interval" && mode == "integrate")
+		{
+			checkpoint_interval = parse_double(value.c_str());
+			if (!(checkpoint_interval > 0.0))
+			{
+				std::cerr << "Error: the checkpoint interval must be a positive number!"
+					<< std::endl;
+				return false;
+			}
+		}
+		else if (name == "--shard" && mode == "integrate")
+		{
+			// The value has the form "i/n" with 0 <= i < n
+			const std::size_t slash = value.find('/');
+			const int index = (slash == std::string::npos)? -1 :
+				parse_int(value.substr(0, slash).c_str());
+			const int count = (slash == std::string::npos)? 0 :
+				parse_int(value.substr(slash + 1).c_str());
+			if (index < 0 || count < 1 || index >= count)
+			{
+				std::cerr << "Error: the shard must be given as 'i/n' with 0 <= i < n!"
+					<< std::endl;
+				return false;
+			}
+			shard_index = static_cast<unsigned>(index);
+			shard_count = static_cast<unsigned>(count);
+		}
+		else if (name == "--fuse" && (mode == "sweep" || mode == "interpolate"))
+		{
+			const int width = parse_int(value.c_str());
+			if (width < 1 || width > static_cast<int>(MAX_FUSED))
+			{
+				std::cerr << "Error: the option '--fuse' requires a number from 1 to "
+					<< MAX_FUSED << "!" << std::endl;
+				return false;
+			}
+			fuse = static_cast<unsigned>(width);
+		}
+		else if (name == "--interpolation-tol" && mode == "interpolate")
+		{
+			interpolation_tolerance = parse_double(value.c_str());
+			if (!(interpolation_tolerance > 0.0))
+			{
+				std::cerr << "Error: the tolerance must be a positive number!" << std::endl;
+				return false;
+			}
+		}
+		else if (name == "--output" && mode == "write")
+			output_path = value;
+		else if (name == "--slice" && mode == "write")
+		{
+			if (!parse_indices(value.c_str(), slice, true))
+				return false;
+		}
+		else if (name == "--decimate" && mode == "write")
+		{
+			const int factor = parse_int(value.c_str());
+			if (factor < 1)
+			{
+				std::cerr << "Error: the decimation factor must be a positive integer!"
+					<< std::endl;
+				return false;
+			}
+			decimation = static_cast<unsigned>(factor);
+		}
+		else if (name == "--marginal" && mode == "write")
+		{
+			if (!parse_indices(value.c_str(), marginal, false))
+				return false;
+		}
+		else if (name == "--format" && mode == "write")
+		{
+			if (value != "json" && value != "npy" && value != "raw")
+			{
+				std::cerr << "Error: unknown output format '" << value
+					<< "'; the available formats are 'json', 'npy' and 'raw'." << std::endl;
+				return false;
+			}
+			format = value;
+		}
+		else
+		{
+			std::cerr << "Error: the option '" << name << "' is not supported in "
+				<< mode << " mode!" << std::endl;
+			return false;
+		}
+		options[name.substr(2)] = value;
+	}
+	if (!slice.empty() && !marginal.empty())
+	{
+		std::cerr << "Error: the options '--slice' and '--marginal' cannot be combined!"
+			<< std::endl;
+		return false;
+	}
+	if (format != "json" && output_path.empty())
+	{
+		std::cerr << "Error: the format '" << format << "' requires the option '--output'!"
+			<< std::endl;
+		return false;
+	}
+	if (tolerance > 0.0 && engine == "fourier")
+	{
+		std::cerr << "Error: the option '--tol' is not supported by the fourier engine!"
+			<< std::endl;
+		return false;
+	}
+	if (!checkpoint_path.empty() && (tolerance > 0.0 || engine == "fourier"))
+	{
+		std::cerr << "Error: checkpoints are not supported with the option '--tol' or "
+			"by the fourier engine!" << std::endl;
+		return false;
+	}
+	if (fuse > 1 && (tolerance > 0.0 || engine == "fourier" || kernel == "jit"))
+	{
+		std::cerr << "Error: the option '--fuse' is not supported with the options '--tol' "
+			"or '--kernel jit', or by the fourier engine!" << std::endl;
+		return false;
+	}
+	if (shard_count > 0 && (tolerance > 0.0 || engine == "fourier"))
+	{
+		std::cerr << "Error: shards are not supported with the option '--tol' or "
+			"by the fourier engine!" << std::endl;
+		return false;
+	}
+	return true;
+}
+// =============================================================================================
+/**
+ * @brief Parses a list of numbers separated by commas, such as "-0.1,-0.2,-0.5",
+ * or a range "from:to:count" of `count` equally spaced numbers from `from` to `to`.
+ * @return true on success, false on malformed input
+ */
+bool parse_values(const char* input, std::vector<double>& values)
+{
+	const std::string text(input);
+	std::vector<std::string> tokens;
+	const char separator = (text.find(':') != std::string::npos)? ':' : ',';
+	std::istringstream splitter(text);
+	for (std::string token; std::getline(splitter, token, separator); )
+		tokens.push_back(token);
+	values.clear();
+	bool valid = true;
+	for (const std::string& token : tokens)
+	{
+		char* end = nullptr;
+		values.push_back(std::strtod(token.c_str(), &end));
+		valid = valid && !token.empty() && (*end == '\0') && std::isfinite(values.back());
+	}
+	if (valid && separator == ':')
+	{
+		const double from = values[0], to = values[1];
+		const double count = values[2];
+		valid = (tokens.size() == 3) && (count >= 1) && (count == std::floor(count));
+		values.clear();
+		for (int k = 0; valid && k < count; k++)
+		{
+			// Round to 15 significant digits, so that e.g. -1:-0.2:5 yields -0.4, not
+			// -0.3999999999999999, as the decimal endpoints were meant
+			const double x = (count > 1)? from + (to - from) * (k / (count - 1)) : from;
+			char buffer[32];
+			std::snprintf(buffer, sizeof(buffer), "%.15g", x);
+			values.push_back(std::strtod(buffer, nullptr));
+		}
+	}
+	if (!valid || values.empty())
+	{
+		std::cerr << "Error: '" << text << "' is neither a list of numbers separated by "
+			"commas nor a range of the form from:to:count!" << std::endl;
+		return false;
+	}
+	return true;
+}
+// =============================================================================================
+/**
+ * @brief Parses a list of non-negative integers separated by commas, in which an entry "*"
+ * (if `allow_free` is true) stands for a free axis and is stored as -1.
+ * @return true on success, false on malformed input
+ */
+bool parse_indices(const char* input, std::vector<int>& indices, bool allow_free)
+{
+	const std::string text(input);
+	std::istringstream splitter(text);
+	indices.clear();
+	bool valid = !text.empty();
+	for (std::string token; valid && std::getline(splitter, token, ','); )
+	{
+		if (allow_free && token == "*")
+		{
+			indices.push_back(-1);
+			continue;
+		}
+		char* end = nullptr;
+		const long value = std::strtol(token.c_str(), &end, 10);
+		valid = !token.empty() && (*end == '\0') && (value >= 0) && (value <= INT_MAX);
+		indices.push_back(static_cast<int>(value));
+	}
+	if (!valid || indices.empty())
+	{
+		std::cerr << "Error: '" << text << "' is not a list of non-negative integers"
+			<< (allow_free? " or '*'" : "") << " separated by commas!" << std::endl;
+		return false;
+	}
+	return true;
+}
+// =============================================================================================
+/**
+ * @brief Parses a segment "from:to" of real numbers, or a single number, which stands for
+ * the segment from the number to itself, into the two endpoints.
+ * @return true on success, false on malformed input
+ */
+bool parse_segment(const char* input, std::vector<double>& endpoints)
+{
+	const std::string text(input);
+	const std::size_t colon = text.find(':');
+	const std::string first = text.substr(0, colon);
+	const std::string second = (colon == std::string::npos)? first : text.substr(colon + 1);
+	endpoints.clear();
+	for (const std::string& token : {first, second})
+	{
+		char* end = nullptr;
+		endpoints.push_back(std::strtod(token.c_str(), &end));
+		if (token.empty() || *end != '\0' || !std::isfinite(endpoints.back()))
+		{
+			std::cerr << "Error: '" << text << "' is neither a number nor a segment of the "
+				"form from:to!" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+// =============================================================================================
+/**
+ * @brief Returns the shortest decimal representation of x which is read back exactly
+ */
+std::string format_double(double x)
+{
+	std::ostringstream formatter;
+	for (int precision = 1; precision <= 17; precision++)
+	{
+		formatter.str("");
+		formatter << std::setprecision(precision) << x;
+		if (std::strtod(formatter.str().c_str(), nullptr) == x)
+			break;
+	}
+	return formatter.str();
 }
 // =============================================================================================
 /**
@@ -136,22 +542,6 @@ bool is_valid_q_S(double Rehbar, int samples)
 	return true;
 }
 // =============================================================================================
-/**
- * @brief Returns the smallest integer greater than |n| and divisible by d
- */
-int make_divisible(int n, int d)
-{
-	if (n<0)
-		n = -n;
-	if (d==0)
-		return n;
-	else if (d<0)
-		d = -d;
-	if (n==0)
-		return d;
-	return (n/d + 1)*d;
-}
-// =============================================================================================
 /**
  * @brief args::fill writes the fields of the `args` struct into a Json value
  * @param json - a Json::Value object
@@ -163,6 +553,8 @@ void args::fill(Json::Value& json)
 	json["samples"] = samples;
 	json["hbar_real"] = hbar.real();
 	json["hbar_imag"] = hbar.imag();
+	if (!options.empty())
+		json["options"] = options;
 }
 // =============================================================================================
 /*
@@ -9,6 +9,8 @@
 
 #include <json/json.h>
 #include <complex>
+#include <string>
+#include <vector>
 
 /**
  * @file This file declare miscellaneous I/O and data validation functions
@@ -23,17 +25,44 @@ struct args
 	std::string hbar_textual;
     int samples;
     const char* filepath;
+	std::string engine;  // integration engine, see the option --engine
+	std::string kernel;  // integration kernel, see the option --kernel
+	std::string tabulation; // how the factors are tabulated, see the option --tabulation
+	double table_cache_size; // megabytes of cached tables (option --table-cache), or 0
+	double tolerance;    // relative tolerance of the refinement (option --tol), or 0
+	std::string checkpoint_path; // checkpoint file (options --checkpoint, --resume), or ""
+	bool resume;         // whether to resume from the checkpoint file
+	double checkpoint_interval; // seconds between checkpoints (option --checkpoint-interval)
+	unsigned shard_index; // which part of the integral to compute (option --shard)...
+	unsigned shard_count; // ...out of how many parts, or 0 to compute the whole integral
+	std::vector<double> re_values; // the values of Re(hbar) in sweep mode, or the endpoints
+	std::vector<double> im_values; // in interpolate mode; likewise for Im(hbar)
+	unsigned fuse;        // in sweep and interpolate modes: values of hbar per grid traversal
+	double interpolation_tolerance; // in interpolate mode (option --interpolation-tol)
+	std::string output_path; // in write mode: the output file (option --output), or ""
+	std::string format;   // in write mode: json, npy or raw (option --format)
+	std::vector<int> slice; // in write mode: the fixed indices, or -1 for the free axes
+	unsigned decimation;  // in write mode: distance between the indices taken (--decimate)
+	std::vector<int> marginal; // in write mode: the axes kept by --marginal (from 1)
+	Json::Value options; // optional parameters as given on the command line
     bool valid;
 	//----------------------
 	void fill(Json::Value& json);
-	args(const char** argv);
+	void set_hbar(double Rehbar, double Imhbar); // selects a point of a sweep
+	args(int argc, const char** argv);
+private:
+	bool parse_options(int argc, const char** argv);
 };
 
 double parse_double(const char* input) noexcept;
 int parse_int(const char* input) noexcept;
+bool parse_values(const char* input, std::vector<double>& values);
+bool parse_segment(const char* input, std::vector<double>& endpoints);
+bool parse_indices(const char* input, std::vector<int>& indices, bool allow_free);
+std::string format_double(double x);
 bool is_valid_q_S(double Rehbar, int samples);
-int make_divisible(int n, int d);
 void print_json(Json::OStream* destination, const Json::Value& data);
+void print_json_line(Json::OStream* destination, const Json::Value& data);
 std::string format_complex_strings(const char* re, const char* im);
 
 #endif
@@ -0,0 +1,444 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#define M3DI_JIT_AVAILABLE
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+#include "arena.h"
+#include "cache.h"
+#include "manifold.h"
+#include "jit.h"
+
+/**
+ * @file
+ * Implementation of the class `jit_kernel`
+ */
+namespace {
+// ================================================================================================
+// Name of the function exported by the generated shared objects
+const char* const ENTRY_POINT = "m3di_kernel";
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Quotes a path for use in a command line of the POSIX shell
+ */
+std::string shell_quote(const std::string& path)
+{
+	std::string quoted = "'";
+	for (char c : path)
+		quoted += (c == '\'')? std::string("'\\''") : std::string(1, c);
+	return quoted + "'";
+}
+#ifdef M3DI_JIT_AVAILABLE
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Returns the command line of the compiler, without the input and output files.
+ */
+std::string compiler_command()
+{
+	const char* env = std::getenv("CXX");
+	return std::string((env && *env)? env : "c++")
+		+ " -std=c++14 -O3 -march=native -ffp-contract=off -fPIC -shared";
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Returns the name of the host, or an empty string if it is unknown.
+ */
+std::string host_name()
+{
+	char name[256] = {};
+	if (gethostname(name, sizeof(name) - 1) != 0)
+		return std::string();
+	return name;
+}
+#endif
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Emits the statement adding the constant `c` to the exponent `e`, reduced mod S.
+ */
+std::string advance_statement(const std::string& e, int c)
+{
+	std::ostringstream code;
+	if (c == 1)
+		code << "if (++" << e << " == S) " << e << " = 0;";
+	else if (c == -1)
+		code << "if (--" << e << " < 0) " << e << " += S;";
+	else if (c > 0)
+		code << e << " += " << c << "; if (" << e << " >= S) " << e << " -= S;";
+	else if (c < 0)
+		code << e << " -= " << -c << "; if (" << e << " < 0) " << e << " += S;";
+	return code.str();
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Emits the expression of the position e + j*c.
+ */
+std::string position_expression(const std::string& e, int c)
+{
+	if (c == 0)
+		return e;
+	if (c == 1)
+		return e + " + j";
+	if (c == -1)
+		return e + " - j";
+	return e + " + j * " + std::to_string(c);
+}
+// ================================================================================================
+} // namespace
+
+/**
+ * @brief
+ * Generates the source code of the kernel for the given increments.
+ * @param increments - the exponent increments (reduced mod samples), see grid_layout
+ * @param columns    - the first `nesting` rows of the LTD matrix, flattened likewise
+ * @remark
+ * Two quads share an exponent only if their increments and their columns of the LTD
+ * matrix coincide. Equal increments alone do not suffice: the offsets L^T e of the
+ * cosets of a refined grid (see integrator::compute_refined_integral) may still differ,
+ * e.g. for columns whose entries differ by an odd multiple of the coarse sample count.
+ */
+std::string jit_kernel::generate(const std::vector<int>& increments,
+	const std::vector<int>& columns, int nesting, int quads, int samples)
+{
+	const int D = nesting, Q = quads;
+	// The increments as signed numbers
+	std::vector<int> c(increments.size());
+	for (size_t i = 0; i < c.size(); i++)
+		c[i] = (increments[i] > samples/2)? increments[i] - samples : increments[i];
+	// Quads with identical increments and columns share an exponent, since then they also
+	// have the same offsets; cls[q] is the exponent of quad q
+	std::vector<int> cls(Q), representative;
+	for (int q = 0; q < Q; q++)
+	{
+		cls[q] = -1;
+		for (size_t k = 0; k < representative.size() && cls[q] < 0; k++)
+		{
+			bool same = true;
+			for (int L = 0; L < D; L++)
+				same = same && (c[L*Q + q] == c[L*Q + representative[k]])
+					&& (columns[L*Q + q] == columns[L*Q + representative[k]]);
+			if (same)
+				cls[q] = static_cast<int>(k);
+		}
+		if (cls[q] < 0)
+		{
+			cls[q] = static_cast<int>(representative.size());
+			representative.push_back(q);
+		}
+	}
+	const int E = static_cast<int>(representative.size());
+	auto coefficient = [&](int level, int k) {return c[level*Q + representative[k]];};
+	auto e = [](int k) {return "e" + std::to_string(k);};
+	// Length of the chunks of the innermost run, as in kernels.cpp
+	int max_shift = 0;
+	for (int k = 0; k < E; k++)
+		max_shift = std::max(max_shift, std::abs(coefficient(D-1, k)));
+	const unsigned chunk = chunk_length(max_shift);
+	const bool direct = (chunk > 0);
+
+	std::ostringstream code;
+	code << "// Integration kernel generated by m3di for " << D << " indices and " << Q
+		<< " quads.\n// The accumulator must match the class KN_accumulator of m3di.\n"
+		"#include <cmath>\nnamespace {\nstruct accumulator\n{\n"
+		"\tdouble rs = 0.0, is = 0.0, rc = 0.0, ic = 0.0;\n"
+		"\tinline void add(double r, double i)\n\t{\n"
+		"\t\tconst double rt = rs + r, it = is + i;\n"
+		"\t\trc += (std::fabs(rs) >= std::fabs(r))? (rs - rt) + r : (r - rt) + rs;\n"
+		"\t\tic += (std::fabs(is) >= std::fabs(i))? (is - it) + i : (i - it) + is;\n"
+		"\t\trs = rt;\n\t\tis = it;\n\t}\n"
+		"\tinline void add_block(const double* re, const double* im, unsigned count)\n\t{\n"
+		"\t\tdouble ls[2][" << KN_LANES << "] = {}, lc[2][" << KN_LANES << "] = {};\n"
+		"\t\tunsigned k = 0;\n"
+		"\t\tfor (; k + " << KN_LANES << " <= count; k += " << KN_LANES << ")\n"
+		"\t\t\tfor (unsigned l = 0; l < " << KN_LANES << "; l++)\n\t\t\t{\n"
+		"\t\t\t\ttwo_sum(ls[0][l], lc[0][l], re[k + l]);\n"
+		"\t\t\t\ttwo_sum(ls[1][l], lc[1][l], im[k + l]);\n\t\t\t}\n"
+		"\t\tfor (unsigned l = 0; k < count; k++, l++)\n\t\t{\n"
+		"\t\t\ttwo_sum(ls[0][l], lc[0][l], re[k]);\n"
+		"\t\t\ttwo_sum(ls[1][l], lc[1][l], im[k]);\n\t\t}\n"
+		"\t\tfor (unsigned l = 1; l < " << KN_LANES << "; l++)\n\t\t{\n"
+		"\t\t\ttwo_sum(ls[0][0], lc[0][0], ls[0][l]);\n"
+		"\t\t\ttwo_sum(ls[1][0], lc[1][0], ls[1][l]);\n"
+		"\t\t\tlc[0][0] += lc[0][l];\n\t\t\tlc[1][0] += lc[1][l];\n\t\t}\n"
+		"\t\tadd(ls[0][0], ls[1][0]);\n"
+		"\t\trc += lc[0][0];\n\t\tic += lc[1][0];\n\t}\n"
+		"\tstatic inline void two_sum(double& s, double& c, double b)\n\t{\n"
+		"\t\tconst double a = s;\n\t\ts = a + b;\n\t\tconst double bb = s - a;\n"
+		"\t\tc += (a - (s - bb)) + (b - bb);\n\t}\n"
+		"\tinline void add_scaled(double f, accumulator& o)\n\t{\n"
+		"\t\tadd(f * (o.rs + o.rc), f * (o.is + o.ic));\n"
+		"\t\to.rs = o.is = o.rc = o.ic = 0.0;\n\t}\n};\n}\n"
+		"extern \"C\" void " << ENTRY_POINT << "(const double* const* re, "
+		"const double* const* im, int S,\n\tconst unsigned* extents, "
+		"const double* step_lengths, const int* offsets, unsigned from, unsigned to,\n"
+		"\tdouble* state)\n{\n";
+	for (int q = 0; q < Q; q++)
+		code << "\tconst double* const r" << q << " = re[" << q << "];\n"
+			<< "\tconst double* const i" << q << " = im[" << q << "];\n";
+	for (int k = 0; k < E; k++)
+	{
+		const int c0 = coefficient(0, k);
+		code << "\tint " << e(k) << " = ";
+		if (c0 == 0)
+			code << "offsets[" << representative[k] << "];\n";
+		else
+			code << "static_cast<int>((offsets[" << representative[k]
+				<< "] + static_cast<long long>(from) * " << c0 << ") % S);\n"
+				<< "\tif (" << e(k) << " < 0) " << e(k) << " += S;\n";
+	}
+	code << "\taccumulator";
+	for (int L = 0; L < D; L++)
+		code << ((L > 0)? ", s" : " s") << L;
+	code << ";\n\tdouble br[" << INTEGRAND_BLOCK << "], bi[" << INTEGRAND_BLOCK << "];\n";
+	// Loops over all indices except the fastest-changing one
+	std::string indent = "\t";
+	for (int L = 0; L < D-1; L++)
+	{
+		if (L == 0)
+			code << indent << "for (unsigned j0 = from; j0 < to; j0++)\n";
+		else
+			code << indent << "for (unsigned j" << L << " = 0; j" << L << " < extents[" << L
+				<< "]; j" << L << "++)\n";
+		code << indent << "{\n";
+		indent += "\t";
+	}
+	// The innermost run, summed in blocks of INTEGRAND_BLOCK values as in kernels.cpp
+	const std::string s = "s" + std::to_string(D-1);
+	code << indent << "{\n" << indent << "\tconst unsigned run = "
+		<< ((D == 1)? "to - from" : "extents[" + std::to_string(D-1) + "]") << ";\n"
+		<< indent << "\tfor (unsigned k0 = 0; k0 < run; k0 += " << INTEGRAND_BLOCK << ")\n"
+		<< indent << "\t{\n"
+		<< indent << "\t\tconst unsigned count = (run - k0 < " << INTEGRAND_BLOCK
+		<< ")? run - k0 : " << INTEGRAND_BLOCK << ";\n";
+	std::string in = indent + "\t\t";
+	if (direct)
+	{
+		code << in << "for (unsigned c0 = 0; c0 < count; c0 += " << chunk << ")\n" << in << "{\n"
+			<< in << "\tconst unsigned length = (count - c0 < " << chunk << ")? count - c0 : "
+			<< chunk << ";\n";
+		in += "\t";
+		// Factors which are constant along the run are loaded once per chunk
+		for (int q = 0; q < Q; q++)
+			if (coefficient(D-1, cls[q]) == 0)
+				code << in << "const double cr" << q << " = r" << q << "[" << e(cls[q])
+					<< "], ci" << q << " = i" << q << "[" << e(cls[q]) << "];\n";
+		code << in << "for (unsigned k = 0; k < length; k++)\n" << in << "{\n"
+			<< in << "\tconst int j = static_cast<int>(k);\n";
+		for (int k = 0; k < E; k++)
+			if (coefficient(D-1, k) != 0)
+				code << in << "\tconst int p" << k << " = "
+					<< position_expression(e(k), coefficient(D-1, k)) << ";\n";
+	}
+	else
+		code << in << "for (unsigned k = 0; k < count; k++)\n" << in << "{\n";
+	for (int q = 0; q < Q; q++)
+	{
+		std::string tr, ti;
+		if (direct && coefficient(D-1, cls[q]) == 0)
+		{
+			tr = "cr" + std::to_string(q);
+			ti = "ci" + std::to_string(q);
+		}
+		else
+		{
+			const std::string p = (direct? "p" : "e") + std::to_string(cls[q]);
+			tr = "r" + std::to_string(q) + "[" + p + "]";
+			ti = "i" + std::to_string(q) + "[" + p + "]";
+		}
+		if (q == 0)
+			code << in << "\tdouble pr = " << tr << ", pi = " << ti << ";\n";
+		else
+			code << in << "\t{\n" << in << "\t\tconst double tr = " << tr << ", ti = " << ti
+				<< ";\n" << in << "\t\tconst double t = pr * tr - pi * ti;\n"
+				<< in << "\t\tpi = pr * ti + pi * tr;\n" << in << "\t\tpr = t;\n"
+				<< in << "\t}\n";
+	}
+	const std::string slot = direct? "[c0 + k]" : "[k]";
+	code << in << "\tbr" << slot << " = pr;\n" << in << "\tbi" << slot << " = pi;\n";
+	if (!direct)
+		for (int k = 0; k < E; k++)
+			if (coefficient(D-1, k) != 0)
+				code << in << "\t" << advance_statement(e(k), coefficient(D-1, k)) << "\n";
+	code << in << "}\n";
+	if (direct)
+	{
+		for (int k = 0; k < E; k++)
+			if (coefficient(D-1, k) != 0)
+				code << in << e(k) << " = (" << e(k) << " + static_cast<int>(length) * "
+					<< coefficient(D-1, k) << ") % S;\n"
+					<< in << "if (" << e(k) << " < 0) " << e(k) << " += S;\n";
+		in.pop_back();
+		code << in << "}\n";
+	}
+	code << in << s << ".add_block(br, bi, count);\n"
+		<< indent << "\t}\n" << indent << "}\n";
+	// Close the outer loops, propagating the sums and advancing the exponents
+	for (int L = D-2; L >= 0; L--)
+	{
+		code << indent << "s" << L << ".add_scaled(step_lengths[" << L+1 << "], s" << L+1
+			<< ");\n";
+		for (int k = 0; k < E; k++)
+			if (coefficient(L, k) != 0)
+				code << indent << advance_statement(e(k), coefficient(L, k)) << "\n";
+		indent.pop_back();
+		code << indent << "}\n";
+	}
+	code << "\tstate[0] = s0.rs;\n\tstate[1] = s0.is;\n"
+		"\tstate[2] = s0.rc;\n\tstate[3] = s0.ic;\n}\n";
+	return code.str();
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Compiles the source code into the shared object `library`.
+ * @return true on success, false on failure.
+ * @remark
+ * The compiler writes to a temporary file, which is renamed once it is complete,
+ * so that concurrent instances of m3di never load a partially written library. The
+ * temporary name contains the host name and the process ID, since the cache directory
+ * may be shared by several machines.
+ */
+bool jit_kernel::compile(const std::string& source, const std::string& library)
+{
+#ifdef M3DI_JIT_AVAILABLE
+	const std::string stem = library.substr(0, library.size() - 3); // without ".so"
+	const std::string temporary = stem + "." + host_name() + "." + std::to_string(getpid());
+	{
+		std::ofstream file(temporary + ".cpp");
+		file << source;
+		if (!file.good())
+		{
+			std::cerr << "Error: cannot write the file '" << temporary << ".cpp'!" << std::endl;
+			return false;
+		}
+	}
+	const std::string command = compiler_command() + " -o "
+		+ shell_quote(temporary + ".so") + " " + shell_quote(temporary + ".cpp");
+	const bool success = (std::system(command.c_str()) == 0)
+		&& (std::rename((temporary + ".so").c_str(), library.c_str()) == 0);
+	if (success)
+		std::rename((temporary + ".cpp").c_str(), (stem + ".cpp").c_str()); // for reference
+	else
+	{
+		std::cerr << "Error: the command '" << command << "' failed!" << std::endl;
+		std::remove((temporary + ".so").c_str());
+		std::remove((temporary + ".cpp").c_str());
+	}
+	return success;
+#else
+	(void) source;
+	(void) library;
+	return false;
+#endif
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Generates and loads the kernel for the given increments, compiling it unless
+ * it is already present in the cache.
+ * @return true on success, false on failure.
+ * @remark
+ * The source begins with comments stating the compiler command and the processor of
+ * the host. They enter the hash naming the library, so that machines with different
+ * instruction sets sharing a cache directory never load each other's libraries.
+ */
+bool jit_kernel::load(const std::vector<int>& increments, const std::vector<int>& columns,
+	int nesting, int quads, int samples)
+{
+#ifdef M3DI_JIT_AVAILABLE
+	const std::string source = "// " + compiler_command() + "\n// " + host_cpu() + "\n"
+		+ generate(increments, columns, nesting, quads, samples);
+	const std::string library = cache_directory() + "/m3di-kernel-" + hash_string(source) + ".so";
+	if (access(library.c_str(), R_OK) != 0 && !compile(source, library))
+		return false;
+	handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (!handle)
+	{
+		std::cerr << "Error: cannot load '" << library << "': " << dlerror() << std::endl;
+		return false;
+	}
+	function = reinterpret_cast<entry_point>(dlsym(handle, ENTRY_POINT));
+	if (!function)
+	{
+		std::cerr << "Error: '" << library << "' does not provide an integration kernel!"
+			<< std::endl;
+		return false;
+	}
+	num_quads = quads;
+	return true;
+#else
+	(void) increments;
+	(void) columns;
+	(void) nesting;
+	(void) quads;
+	(void) samples;
+	std::cerr << "Error: generated kernels are not supported on this platform." << std::endl;
+	return false;
+#endif
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief Unloads the shared object of the kernel.
+ */
+jit_kernel::~jit_kernel()
+{
+#ifdef M3DI_JIT_AVAILABLE
+	if (handle)
+		dlclose(handle);
+#endif
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Computes the Riemann sum over the points whose first index lies in [from, to);
+ * the result is not yet multiplied by step_lengths[0].
+ */
+KN_accumulator jit_kernel::operator()(const kernel_input& input, unsigned from,
+	unsigned to) const
+{
+	if (from >= to)
+		return KN_accumulator();
+	std::vector<const double*> re(num_quads), im(num_quads);
+	for (int q = 0; q < num_quads; q++)
+	{
+		re[q] = input.tables[q].re;
+		im[q] = input.tables[q].im;
+	}
+	double state[4];
+	function(re.data(), im.data(), input.samples, input.extents, input.step_lengths,
+		input.offsets, from, to, state);
+	return KN_accumulator(state);
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -0,0 +1,97 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <string>
+#include <vector>
+
+#include "kahan.h"
+#include "kernels.h"
+
+/**
+ * @class
+ * An integration kernel generated at run time for the matrix of exponent increments
+ * of the loaded triangulation
+ *
+ * @remark
+ * The kernel is emitted as C++ source code, in which the increments are literal
+ * constants: zero increments vanish, increments of +1 and -1 become increments and
+ * decrements, and quads with identical increments and columns of the LTD matrix share
+ * a single exponent (the columns determine the offsets of refined grids). The source is
+ * compiled by the system compiler (the environment variable CXX, or `c++`) into a
+ * shared object, which is then loaded with dlopen(). The shared objects are cached in
+ * the directory $M3DI_CACHE, or else $XDG_CACHE_HOME/m3di or ~/.cache/m3di, under a
+ * name derived from a hash of the source code, the compiler command and the processor
+ * of the host (for -march=native). Hence the compiler runs only once for every matrix
+ * and machine. The generated kernel performs the same floating point operations
+ * in the same order as the kernels of kernels.h, so the results are identical.
+ *
+ * This is only available on POSIX systems.
+ *
+ * Public member functions:
+ *
+ * jit_kernel()                             - constructs an empty object
+ *
+ * bool load(increments, columns, nesting, quads, samples)
+ *                                          - generates, compiles (unless cached) and
+ *                                            loads the kernel for the given increments;
+ *                                            `columns` are the first `nesting` rows of
+ *                                            the LTD matrix, which determine the offsets.
+ *                                            Returns false on failure.
+ *
+ * KN_accumulator operator()(input, from, to)
+ *                                          - computes the Riemann sum like the kernels
+ *                                            in kernels.h; `input.increments` is ignored.
+ *
+ */
+class jit_kernel
+{
+	private:
+	// The signature of the generated function
+	using entry_point = void (*)(const double* const* re, const double* const* im, int samples,
+		const unsigned* extents, const double* step_lengths, const int* offsets,
+		unsigned from, unsigned to, double* state);
+	void* handle {nullptr};
+	entry_point function {nullptr};
+	int num_quads {0};
+
+	static std::string generate(const std::vector<int>& increments,
+		const std::vector<int>& columns, int nesting, int quads, int samples);
+	bool compile(const std::string& source, const std::string& library);
+
+	public:
+	jit_kernel() = default;
+	~jit_kernel();
+	jit_kernel(const jit_kernel&) = delete;
+	jit_kernel& operator=(const jit_kernel&) = delete;
+
+	bool load(const std::vector<int>& increments, const std::vector<int>& columns,
+		int nesting, int quads, int samples);
+	KN_accumulator operator()(const kernel_input& input, unsigned from, unsigned to) const;
+};
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -14,6 +14,30 @@
  */
 
 // =============================================================================================
+/**
+ * @brief
+ * Constructs an accumulator in the state previously saved by store().
+ * @param state - array of the sums and compensations of the real and imaginary parts
+*/
+KN_accumulator::KN_accumulator(const double* state) :
+	re_sum {state[0]}, im_sum {state[1]},
+	re_compensation {state[2]}, im_compensation {state[3]}
+{
+}
+// ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Saves the state of the accumulator into an array of four doubles, in the order
+ * real sum, imaginary sum, real compensation, imaginary compensation.
+*/
+void KN_accumulator::store(double* state) const
+{
+	state[0] = re_sum;
+	state[1] = im_sum;
+	state[2] = re_compensation;
+	state[3] = im_compensation;
+}
+// ---------------------------------------------------------------------------------------------
 /**
  * @brief
  * Resets the KN_accumulator to the initial state.
@@ -60,6 +84,60 @@ void KN_accumulator::operator+= (CC increment)
 	im_sum = im_tentative;
 }
 // ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Adds `count` values with the given real and imaginary parts, see the class description.
+*/
+void KN_accumulator::add_block(const double* re, const double* im, unsigned count)
+{
+	double rs[KN_LANES] = {}, is[KN_LANES] = {}; // partial sums
+	double rc[KN_LANES] = {}, ic[KN_LANES] = {}; // their compensations
+	// TwoSum: s + e == a + b exactly, where s = fl(a + b)
+	auto two_sum = [](double& s, double& c, double b)
+	{
+		const double a = s;
+		s = a + b;
+		const double bb = s - a;
+		c += (a - (s - bb)) + (b - bb);
+	};
+	unsigned k = 0;
+	for (; k + KN_LANES <= count; k += KN_LANES)
+		for (unsigned l = 0; l < KN_LANES; l++)
+		{
+			two_sum(rs[l], rc[l], re[k + l]);
+			two_sum(is[l], ic[l], im[k + l]);
+		}
+	for (unsigned l = 0; k < count; k++, l++)
+	{
+		two_sum(rs[l], rc[l], re[k]);
+		two_sum(is[l], ic[l], im[k]);
+	}
+	// Combine the lanes, again computing the rounding errors exactly
+	for (unsigned l = 1; l < KN_LANES; l++)
+	{
+		two_sum(rs[0], rc[0], rs[l]);
+		two_sum(is[0], ic[0], is[l]);
+		rc[0] += rc[l];
+		ic[0] += ic[l];
+	}
+	operator+=(CC(rs[0], is[0]));
+	re_compensation += rc[0];
+	im_compensation += ic[0];
+}
+// ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Merges another accumulator into this one.
+ * The sum of `other` is added with compensation, while its own
+ * compensation terms are carried over unchanged.
+*/
+void KN_accumulator::operator+= (const KN_accumulator& other)
+{
+	operator+=(CC(other.re_sum, other.im_sum));
+	re_compensation += other.re_compensation;
+	im_compensation += other.im_compensation;
+}
+// ---------------------------------------------------------------------------------------------
 /**
  * @brief Conversion operator for getting a complex number out
  */
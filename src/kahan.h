@@ -10,6 +10,8 @@
 #include <vector>
 
 using CC = std::complex<double>;
+// Number of independent partial sums used by KN_accumulator::add_block()
+constexpr unsigned KN_LANES = 8;
 /**
  * @class
  * Complex number with compensated addition
@@ -22,6 +24,16 @@ using CC = std::complex<double>;
  * The Kahan-Neumaier algorithm is applied separately to real and imaginary
  * parts.
  *
+ * The member function add_block() adds a block of values stored as separate
+ * arrays of real and imaginary parts. The values are distributed over KN_LANES
+ * independent partial sums, each of which is compensated by the branch-free TwoSum
+ * algorithm, which computes the rounding error of every addition exactly, just like
+ * the Kahan-Neumaier update. The lanes are independent, so the compiler may keep
+ * them in SIMD registers. At the end of the block, the partial sums are combined by
+ * TwoSum and added to the accumulator with compensation, and their compensations
+ * are carried over. Hence the error bound is the same as for the value-by-value
+ * summation, but the result may differ from it in the last bits.
+ *
 */
 class KN_accumulator
 {
@@ -32,11 +44,15 @@ class KN_accumulator
 	double im_compensation {0.0};
 	public:
 	KN_accumulator() = default;
+	explicit KN_accumulator(const double* state); // restores a state saved by store()
 	~KN_accumulator() = default;
 	void reset(void);
 	void operator+= (CC increment);
+	void operator+= (const KN_accumulator& other);
 	void accumulate(const std::vector<CC>& v);
+	void add_block(const double* re, const double* im, unsigned count);
 	operator CC();
+	void store(double* state) const; // saves the four components of the state
 };
 
 #endif
@@ -0,0 +1,223 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#include <algorithm>
+#include <complex>
+#include <cstdlib>
+
+#include "manifold.h"
+#include "kernels.h"
+
+/**
+ * @file
+ * Implementation of the specialized integration kernels, see kernels.h
+ */
+namespace {
+// ================================================================================================
+/**
+ * @brief
+ * Adds a row of exponent increments to the exponents, reducing the results mod S.
+ */
+template<int Q>
+inline void advance(int* exponents, const int* row, int S)
+{
+	for (int q = 0; q < Q; q++)
+	{
+		int e = exponents[q] + row[q];
+		exponents[q] = (e >= S)? e - S : e;
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Adds the values of the integrand at `run` consecutive points of the fastest-changing
+ * index to `sum`, advancing the exponents past the last point.
+ * @remark
+ * The values are summed in blocks of INTEGRAND_BLOCK points, like in the generic path.
+ * Each block is computed in chunks whose positions fit into the wrap-around padding of
+ * the tables, so that no reduction mod S is needed within a chunk. If the increments
+ * are too large for this, the exponents are reduced at every point instead.
+ */
+template<int Q>
+inline void sum_run(const kernel_input& in, int* exponents, const int* row, unsigned run,
+	KN_accumulator& sum)
+{
+	const int S = in.samples;
+	const double* table_re[Q];
+	const double* table_im[Q];
+	int shift[Q]; // the increments as signed numbers
+	int max_shift = 0;
+	for (int q = 0; q < Q; q++)
+	{
+		table_re[q] = in.tables[q].re;
+		table_im[q] = in.tables[q].im;
+		shift[q] = (row[q] > S/2)? row[q] - S : row[q];
+		max_shift = std::max(max_shift, std::abs(shift[q]));
+	}
+	const unsigned chunk = chunk_length(max_shift);
+	const bool direct = (chunk > 0);
+
+	alignas(64) double re[INTEGRAND_BLOCK], im[INTEGRAND_BLOCK];
+	for (unsigned k0 = 0; k0 < run; k0 += INTEGRAND_BLOCK)
+	{
+		const unsigned count = std::min(run - k0, INTEGRAND_BLOCK);
+		if (direct)
+		{
+			for (unsigned c0 = 0; c0 < count; c0 += chunk)
+			{
+				const unsigned length = std::min(count - c0, chunk);
+				for (unsigned k = 0; k < length; k++)
+				{
+					const int j = static_cast<int>(k);
+					int p = exponents[0] + j * shift[0];
+					double pr = table_re[0][p], pi = table_im[0][p];
+					for (int q = 1; q < Q; q++)
+					{
+						p = exponents[q] + j * shift[q];
+						const double tr = table_re[q][p], ti = table_im[q][p];
+						const double r = pr * tr - pi * ti;
+						pi = pr * ti + pi * tr;
+						pr = r;
+					}
+					re[c0 + k] = pr;
+					im[c0 + k] = pi;
+				}
+				for (int q = 0; q < Q; q++)
+				{
+					int e = (exponents[q] + static_cast<int>(length) * shift[q]) % S;
+					exponents[q] = (e < 0)? e + S : e;
+				}
+			}
+		}
+		else
+		{
+			for (unsigned k = 0; k < count; k++)
+			{
+				double pr = table_re[0][exponents[0]], pi = table_im[0][exponents[0]];
+				for (int q = 1; q < Q; q++)
+				{
+					const double tr = table_re[q][exponents[q]], ti = table_im[q][exponents[q]];
+					const double r = pr * tr - pi * ti;
+					pi = pr * ti + pi * tr;
+					pr = r;
+				}
+				re[k] = pr;
+				im[k] = pi;
+				advance<Q>(exponents, row, S);
+			}
+		}
+		sum.add_block(re, im, count);
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * The loop nest over the last R of the D indices; nest<D, Q, R>::run() lets the index
+ * at level D-R run over [begin, end).
+ */
+template<int D, int Q, int R>
+struct nest
+{
+	static inline void run(const kernel_input& in, int* exponents, KN_accumulator* sums,
+		unsigned begin, unsigned end)
+	{
+		constexpr int L = D - R; // the level of this loop
+		const int* row = in.increments + L * Q;
+		for (unsigned i = begin; i < end; i++)
+		{
+			nest<D, Q, R-1>::run(in, exponents, sums, 0, in.extents[L+1]);
+			sums[L] += in.step_lengths[L+1] * CC(sums[L+1]);
+			sums[L+1].reset();
+			advance<Q>(exponents, row, in.samples);
+		}
+	}
+};
+// The innermost loop, over the fastest-changing index
+template<int D, int Q>
+struct nest<D, Q, 1>
+{
+	static inline void run(const kernel_input& in, int* exponents, KN_accumulator* sums,
+		unsigned begin, unsigned end)
+	{
+		sum_run<Q>(in, exponents, in.increments + (D-1) * Q, end - begin, sums[D-1]);
+	}
+};
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * The kernel for D indices and Q quads; see integrator::odometer_sum() for the
+ * generic version.
+ */
+template<int D, int Q>
+KN_accumulator fixed_kernel(const kernel_input& in, unsigned from, unsigned to)
+{
+	if (from >= to)
+		return KN_accumulator();
+	int exponents[Q];
+	for (int q = 0; q < Q; q++)
+		exponents[q] = static_cast<int>(
+			(in.offsets[q] + static_cast<long long>(from) * in.increments[q]) % in.samples);
+	KN_accumulator sums[D];
+	nest<D, Q, D>::run(in, exponents, sums, from, to);
+	return sums[0];
+}
+// ================================================================================================
+} // namespace
+
+/**
+ * @brief
+ * Computes the length of the chunks of a run which can be evaluated without reducing
+ * the exponents, see sum_run().
+ * @return a power of two dividing INTEGRAND_BLOCK, or 0 if it would be less than 8.
+ */
+unsigned chunk_length(int max_shift)
+{
+	unsigned chunk = INTEGRAND_BLOCK;
+	while (chunk >= 8 && static_cast<long long>(chunk) * max_shift > ARENA_PADDING)
+		chunk /= 2;
+	return (chunk >= 8)? chunk : 0;
+}
+// ================================================================================================
+/**
+ * @brief
+ * Selects the integration kernel for `nesting` indices and `num_quads` quads.
+ * @return the specialized kernel, or nullptr if the generic path must be used.
+ */
+integration_kernel select_kernel(int nesting, int num_quads)
+{
+	if (num_quads != 3 * (nesting + 1)) // only triangulations with a single cusp
+		return nullptr;
+	switch (nesting)
+	{
+		case 1: return fixed_kernel<1, 6>;
+		case 2: return fixed_kernel<2, 9>;
+		case 3: return fixed_kernel<3, 12>;
+		case 4: return fixed_kernel<4, 15>;
+		case 5: return fixed_kernel<5, 18>;
+		case 6: return fixed_kernel<6, 21>;
+		default: return nullptr;
+	}
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -0,0 +1,72 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include "arena.h"
+#include "kahan.h"
+
+/**
+ * @file
+ * Integration kernels specialized at compile time for small triangulations
+ *
+ * @remark
+ * The generic Riemann summation (integrator::odometer_sum) works for any dimension,
+ * with loop bounds given by the dimension and the number of quads at run time. For
+ * triangulations with N = 2, ..., 7 tetrahedra (and one cusp), the kernels declared
+ * here perform the same summation with a fixed-depth loop nest over the N-1 indices,
+ * and with the exponent updates and the products of the 3N factors unrolled. The
+ * order of all floating point operations is the same as in the generic path, so the
+ * results are identical.
+ */
+
+/**
+ * @brief
+ * The data needed by an integration kernel, see integrator::odometer_sum()
+ */
+struct kernel_input
+{
+	const table_view* tables;    // the tabulated factors, one per quad
+	int samples;                 // the number of sample points (period of the tables)
+	const unsigned* extents;     // extents of the indices, see grid_layout
+	const int* increments;       // exponent increments of the indices, see grid_layout
+	const double* step_lengths;  // 1/extents
+	const int* offsets;          // exponents of the point with all indices equal to 0
+};
+
+// A kernel computes the Riemann sum over the points whose first index lies in [from, to);
+// the result is not yet multiplied by step_lengths[0].
+using integration_kernel = KN_accumulator (*)(const kernel_input& input,
+	unsigned from, unsigned to);
+
+// Returns the length of the chunks of a run in which all positions fit into the padding
+// of the tables, given the largest absolute increment; 0 if the chunks would be too short
+unsigned chunk_length(int max_shift);
+
+// Returns the specialized kernel for the given dimensions, or nullptr if there is none
+integration_kernel select_kernel(int nesting, int num_quads);
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -38,13 +38,22 @@ int main(int argc, const char** argv)
 	switch (mode)
 	{
 		case program_mode::integrate:
-			return integrate_mode(argv);
+			return integrate_mode(argc, argv);
 
 		case program_mode::help:
 			return display_help(argc, argv);
 
 		case program_mode::write:
-			return write_mode(argv);
+			return write_mode(argc, argv);
+
+		case program_mode::sweep:
+			return sweep_mode(argc, argv);
+
+		case program_mode::merge:
+			return merge_mode(argc, argv);
+
+		case program_mode::interpolate:
+			return interpolate_mode(argc, argv);
 
 		case program_mode::usage:
 		default:
@@ -4,13 +4,16 @@
  *   License information at the end of the file.
  */
 
+#include <algorithm>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <iostream>
 #include <json/json.h>
 #include <complex>
 #include <vector>
 
+#include "cache.h"
 #include "manifold.h"
 /**
  * @file
@@ -204,34 +207,394 @@ mani_data::mani_data(const char* filepath)
 	if (valid_state)
 	{
 		num_quads = 3*N;
-		// Allocate the vector for shared_ptr's to tabulations of factors:
-		G_q_tables.resize(num_quads);
+		// Allocate the vector for the views of the tabulated factors:
+		tables.resize(num_quads);
+		index_tables();
+		smith_reduce();
 	}
 	else std::cerr << "Could not load triangulation info." << std::endl;
 }
+// ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Destructor of class mani_data; waits for a background tabulation, if any.
+*/
+mani_data::~mani_data()
+{
+	if (staging_batch)
+		staging_batch->finish();
+}
 // =============================================================================================
 /**
  * @brief
  * Tabulates the values of the individual G_q(...) factors of the integrand.
+ * @remark
+ * Nothing is computed if the tables for these arguments are already present,
+ * or if they have been prefetched; see prefetch_tabulation().
  */
-void mani_data::tabulate(std::complex<double> hbar, int samples)
+void mani_data::tabulate(std::complex<double> given_hbar, int samples)
 {
 	if (!valid_state)
 		return;
+	if (ready() && hbar == given_hbar && tables[0].size() == samples)
+		return;
+	if (finish_prefetch(given_hbar, samples))
+		return;
+	hbar = given_hbar;
 	//Compute the constant prefactor [c(q)]^N
-	prefactor = std::pow(c(std::exp(hbar)), N);
+	prefactor = prefactor_at(hbar);
+	valid_tabulation = false;
+	const int num_tables = static_cast<int>(table_angles.size());
+	// Tables found in the cache are used directly; the others are computed in the arena
+	std::vector<table_view> views(num_tables);
+	std::vector<int> missing;
+	if (cache)
+		cache->release();
+	for (int t=0; t < num_tables; t++)
+		if (!cache || !cache->lookup(table_angles[t], hbar, samples, method, views[t]))
+			missing.push_back(t);
+	const int num_missing = static_cast<int>(missing.size());
+	if (!arena.allocate(std::max(num_missing, 1), samples))
+		return;
+	tabulation_batch batch;
+	for (int i=0; i < num_missing; i++)
+		batch.add(table_angles[missing[i]], hbar, samples, arena.real(i), arena.imag(i),
+			0, 1, 1, method);
+	// The tables are computed in chunks by a pool of threads
+	batch.start();
+	batch.finish();
+	arena.wrap();
+	for (int i=0; i < num_missing; i++)
+	{
+		views[missing[i]] = arena.view(i);
+		if (cache)
+			cache->publish(table_angles[missing[i]], hbar, samples, method, views[missing[i]]);
+	}
+	for (int quad=0; quad < num_quads; quad++)
+		tables[quad] = views[table_of_quad[quad]];
+	valid_tabulation = true;
+}
+// ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Starts tabulating the factors of the integrand for `given_hbar` in the background,
+ * while the current tables remain valid. The prefetched tables are put in place by the
+ * next call of tabulate() with the same arguments, which only waits for them to complete.
+ * A previous prefetch that has not been used is discarded.
+ */
+void mani_data::prefetch_tabulation(std::complex<double> given_hbar, int samples)
+{
+	// With the cache of table files, tabulate() maps the cached tables instead
+	if (!valid_state || cache)
+		return;
+	finish_prefetch(given_hbar, -1); // discard
+	const int num_tables = static_cast<int>(table_angles.size());
+	if (!staging.allocate(num_tables, samples))
+		return;
+	staging_hbar = given_hbar;
+	staging_samples = samples;
+	staging_batch = std::make_unique<tabulation_batch>();
+	for (int t=0; t < num_tables; t++)
+		staging_batch->add(table_angles[t], staging_hbar, samples, staging.real(t),
+			staging.imag(t), 0, 1, 1, method);
+	staging_batch->start();
+}
+// ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Tabulates the factors of the integrand for all of the given values of hbar (at most
+ * MAX_FUSED of them) in the arena `fused`. The value of the factor of a quad at the
+ * position k for hbars[j] is stored at the index k*hbars.size() + j of its table.
+ * The ordinary tables are not affected.
+ * @return true on success
+ */
+bool mani_data::tabulate_fused(const std::vector< std::complex<double> >& hbars, int samples)
+{
+	fused_prefactors.clear();
+	fused_tables.clear();
+	const int width = static_cast<int>(hbars.size());
+	if (!valid_state || width < 1 || width > static_cast<int>(MAX_FUSED))
+		return false;
+	const int num_tables = static_cast<int>(table_angles.size());
+	if (!fused.allocate(num_tables, samples * width))
+		return false;
+	tabulation_batch batch;
+	for (int t=0; t < num_tables; t++)
+		for (int j=0; j < width; j++)
+			batch.add(table_angles[t], hbars[j], samples, fused.real(t) + j,
+				fused.imag(t) + j, 0, 1, width, method);
+	batch.start();
+	batch.finish();
+	fused.wrap();
+	for (int quad=0; quad < num_quads; quad++)
+		fused_tables.push_back(fused.view(table_of_quad[quad]));
+	for (const auto& value : hbars)
+		fused_prefactors.push_back(prefactor_at(value));
+	return true;
+}
+// ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Waits for the background tabulation, if any. If it was started with the given
+ * arguments, its tables replace the current ones.
+ * @return true if the prefetched tables are now in use.
+ */
+bool mani_data::finish_prefetch(std::complex<double> given_hbar, int samples)
+{
+	if (!staging_batch)
+		return false;
+	staging_batch->finish();
+	staging_batch.reset();
+	if (staging_hbar != given_hbar || staging_samples != samples)
+		return false;
+	hbar = given_hbar;
+	prefactor = prefactor_at(hbar);
+	staging.wrap();
+	arena.swap(staging);
+	if (cache)
+		cache->release();
+	for (int quad=0; quad < num_quads; quad++)
+		tables[quad] = arena.view(table_of_quad[quad]);
+	valid_tabulation = true;
+	return true;
+}
+// ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Returns the constant prefactor [c(q)]^N for q = exp(hbar); the product defining c(q)
+ * is truncated unless the method is `reference`, see transcendental.cpp.
+ */
+std::complex<double> mani_data::prefactor_at(std::complex<double> given_hbar) const
+{
+	const std::complex<double> q = std::exp(given_hbar);
+	if (method == tabulation_method::reference)
+		return std::pow(c(q), N);
+	return std::pow(c(q, c_factors(std::abs(q))), N);
+}
+// ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Selects how the values of G_q are computed by the following tabulations; the current
+ * tables are discarded if they were computed by the other method.
+ */
+void mani_data::set_tabulation_method(tabulation_method how)
+{
+	if (how == method)
+		return;
+	method = how;
+	valid_tabulation = false;
+	finish_prefetch(hbar, -1); // discard
+}
+// ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Makes tabulate() look up the tables in the cache of table files and store the tables
+ * it computes there; see cache.h. The size of the cache is limited to max_bytes.
+ */
+void mani_data::enable_table_cache(unsigned long long max_bytes)
+{
+	cache = std::make_unique<table_cache>(max_bytes);
+}
+// =============================================================================================
+/**
+ * @brief
+ * Doubles the number of sample points of the tabulated factors.
+ * @remark
+ * The sample points for 2*samples are those for `samples` together with the midpoints
+ * between them. The values at the old sample points are copied to the even positions
+ * of the new tables; they are identical to what a new tabulation would compute, since
+ * the angles of the sample points are computed by the same floating point operations.
+ * Only the values at the odd positions are computed.
+ */
+void mani_data::refine_tabulation()
+{
+	if (!ready())
+		return;
+	const int samples = tables[0].size();
+	valid_tabulation = false;
+	table_arena refined;
+	const int num_tables = static_cast<int>(table_angles.size());
+	if (!refined.allocate(num_tables, 2*samples))
+		return;
+	std::vector<table_view> previous(num_tables);
 	for (int quad=0; quad < num_quads; quad++)
+		previous[table_of_quad[quad]] = tables[quad];
+	tabulation_batch batch;
+	for (int t=0; t < num_tables; t++)
 	{
-		// Launch tabulation for each G_q factor
-		// TODO: instead of 1 thread per quad, decide thread count more intelligently.
-		G_q_tables[quad] = std::make_shared<tabulation>(angles[quad], hbar, samples);
+		batch.add(table_angles[t], hbar, 2*samples, refined.real(t), refined.imag(t),
+			1, 2, 1, method);
+		double* re = refined.real(t);
+		double* im = refined.imag(t);
+		for (int k = 0; k < samples; k++)
+		{
+			re[2*k] = previous[t].re[k];
+			im[2*k] = previous[t].im[k];
+		}
 	}
-	// Tabulation threads are now running in parallel.
-	for (auto& quad : G_q_tables)
-		quad->finish();
+	batch.start();
+	batch.finish();
+	refined.wrap();
+	arena.swap(refined);
+	if (cache)
+		cache->release();
+	for (int quad=0; quad < num_quads; quad++)
+		tables[quad] = arena.view(table_of_quad[quad]);
 	valid_tabulation = true;
 }
 // =============================================================================================
+/**
+ * @brief
+ * Assigns a table to each quad. The table of G_q depends on the quad only through its
+ * angle, so quads with equal angles share a single table, which is computed once.
+ */
+void mani_data::index_tables()
+{
+	table_angles.clear();
+	table_of_quad.assign(num_quads, 0);
+	for (int quad=0; quad < num_quads; quad++)
+	{
+		auto found = std::find(table_angles.begin(), table_angles.end(), angles[quad]);
+		table_of_quad[quad] = static_cast<int>(found - table_angles.begin());
+		if (found == table_angles.end())
+			table_angles.push_back(angles[quad]);
+	}
+}
+// =============================================================================================
+/**
+ * @brief
+ * Computes the Smith normal form of the first `nesting` rows of the LTD matrix.
+ * Stores the elementary divisors and the matrix U*LTD, where U is the unimodular
+ * matrix of row operations bringing LTD to its Smith normal form.
+ * @remark
+ * The column operations are only applied to the working copy, since we do not need
+ * the matrix V. The matrices are tiny, so a straightforward algorithm suffices.
+ */
+void mani_data::smith_reduce()
+{
+	const int n = nesting;
+	const int m = num_quads;
+	std::vector<long long> A(LTD.begin(), LTD.begin() + static_cast<size_t>(n) * m);
+	std::vector<long long> U(static_cast<size_t>(n) * n, 0);
+	for (int i = 0; i < n; i++)
+		U[n*i + i] = 1;
+	auto a = [&](int i, int j) -> long long& {return A[m*i + j];};
+	auto swap_rows = [&](int i, int j)
+	{
+		for (int c = 0; c < m; c++) std::swap(a(i,c), a(j,c));
+		for (int c = 0; c < n; c++) std::swap(U[n*i + c], U[n*j + c]);
+	};
+	auto add_row = [&](int target, int source, long long factor) // row[target] += f*row[source]
+	{
+		for (int c = 0; c < m; c++) a(target,c) += factor * a(source,c);
+		for (int c = 0; c < n; c++) U[n*target + c] += factor * U[n*source + c];
+	};
+	elementary_divisors.assign(n, 0);
+	for (int t = 0; t < n; t++)
+	{
+		for (;;)
+		{
+			// Move the smallest nonzero entry of the remaining block to position (t,t)
+			int pi = -1, pj = -1;
+			for (int i = t; i < n; i++)
+				for (int j = t; j < m; j++)
+					if (a(i,j) != 0 && (pi < 0 || std::abs(a(i,j)) < std::abs(a(pi,pj))))
+					{
+						pi = i;
+						pj = j;
+					}
+			if (pi < 0)
+				break; // the remaining block vanishes
+			if (pi != t)
+				swap_rows(t, pi);
+			if (pj != t)
+				for (int i = 0; i < n; i++)
+					std::swap(a(i,t), a(i,pj));
+			// Reduce row t and column t by the pivot
+			const long long p = a(t,t);
+			bool reduced = true;
+			for (int i = t+1; i < n; i++)
+			{
+				add_row(i, t, -(a(i,t) / p));
+				reduced = reduced && (a(i,t) == 0);
+			}
+			for (int j = t+1; j < m; j++)
+			{
+				long long f = a(t,j) / p;
+				for (int i = t; i < n; i++)
+					a(i,j) -= f * a(i,t);
+				reduced = reduced && (a(t,j) == 0);
+			}
+			if (!reduced)
+				continue;
+			// The pivot must divide all entries of the remaining block
+			int offender = -1;
+			for (int i = t+1; i < n && offender < 0; i++)
+				for (int j = t+1; j < m; j++)
+					if (a(i,j) % p != 0)
+					{
+						offender = i;
+						break;
+					}
+			if (offender < 0)
+			{
+				elementary_divisors[t] = std::abs(p);
+				break;
+			}
+			add_row(t, offender, 1);
+		}
+	}
+	// LTD_smith = U * (first n rows of LTD)
+	LTD_smith.assign(static_cast<size_t>(n) * m, 0);
+	for (int i = 0; i < n; i++)
+		for (int k = 0; k < n; k++)
+			for (int j = 0; j < m; j++)
+				LTD_smith[m*i + j] += U[n*i + k] * LTD[m*k + j];
+}
+// =============================================================================================
+/**
+ * @brief Greatest common divisor of |a| and |b|; in particular, gcd(0, b) == |b|.
+ */
+static long long gcd(long long a, long long b)
+{
+	a = std::abs(a);
+	b = std::abs(b);
+	while (b != 0)
+	{
+		long long r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+// ---------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Returns the layout of a traversal of the sample grid visiting each distinct value of the
+ * integrand only once, based on the Smith normal form of the LTD matrix; see grid_layout.
+ */
+grid_layout mani_data::grid(int samples) const
+{
+	grid_layout layout;
+	layout.extents.assign(nesting, samples);
+	layout.increments.resize(static_cast<size_t>(nesting) * num_quads);
+	layout.multiplicity = 1;
+	for (int i = 0; i < nesting; i++)
+	{
+		long long g = gcd(elementary_divisors[i], samples);
+		layout.extents[i] = static_cast<unsigned>(samples / g);
+		layout.multiplicity *= g;
+	}
+	// Without any reduction, we keep the original coordinates
+	const bool reduce = (layout.multiplicity > 1);
+	for (size_t i = 0; i < layout.increments.size(); i++)
+	{
+		long long r = (reduce? LTD_smith[i] : LTD[i]) % samples;
+		layout.increments[i] = static_cast<int>((r < 0)? r + samples : r);
+	}
+	return layout;
+}
+// =============================================================================================
 /*
  *
  * Copyright (C) 2019-2021 Rafael M. Siejakowski
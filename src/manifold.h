@@ -8,12 +8,21 @@
 
 #include <json/json.h>
 #include <complex>
+#include <memory>
 #include <vector>
 
+#include "arena.h"
 #include "tabulation.h"
 
+class table_cache;
+
 #define TRIM_LTD // Makes the program store only the first N-k rows of the LTD matrix
 
+// Maximal number of points evaluated by a single call to get_integrand_block()
+constexpr unsigned INTEGRAND_BLOCK = 64;
+// Maximal number of values of hbar tabulated together by tabulate_fused()
+constexpr unsigned MAX_FUSED = 16;
+
 /**
  * @remarks
  * class mani_data
@@ -33,7 +42,30 @@
  * tabulate(hbar, samples)         - Precomputes the values of G_q(...) occurring as factors
  *                                 - of the integrand.
  *
+ * prefetch_tabulation(hbar, samples)
+ *                                 - starts computing the tables for another value of hbar
+ *                                   in the background, while the current tables stay in use.
+ *                                   A later call of tabulate() with the same arguments then
+ *                                   only waits for these tables and switches to them.
+ *
+ * tabulate_fused(hbars, samples)  - tabulates the factors for several values of hbar at
+ *                                   once, in a separate interleaved arena: the values of a
+ *                                   quad at one position for all of the values of hbar are
+ *                                   stored next to each other. See fused.h.
+ *
+ * set_tabulation_method(method)   - selects how the tables are computed; see tabulation.h.
+ *
+ * enable_table_cache(max_bytes)   - makes tabulate() reuse the tables stored in files by
+ *                                   earlier runs and store the new ones; see cache.h.
+ *
+ * refine_tabulation()             - doubles the number of sample points of the tabulation.
+ *                                   The values at the previous sample points are reused,
+ *                                   since they occupy the even positions of the new tables.
+ *
  * unsigned int num_tetrahedra()   - returns the number of tetrahedra in the triangulation
+ *
+ * unsigned int num_tables()       - returns the number of distinct tables of G_q; quads with
+ *                                   equal angles share a table.
  * 
  * bool is_valid()                 - tells whether the object has been initialized correctly
  *                                   and is in a valid state
@@ -46,7 +78,49 @@
  *                                 - returns the value of the integrand at the point defined
  *                                   by the indices. Each index runs from 0 to samples.
  *
+ * grid_layout grid(samples)       - describes a traversal of the sample grid which visits
+ *                                   each distinct value of the integrand only once; see
+ *                                   the description of grid_layout below.
+ *
+ * std::complex<double> get_integrand_value_at(exponents)
+ *                                 - returns the value of the integrand at a point given
+ *                                   by its (already reduced) exponents t*l(□), one per quad.
+ *
+ * get_integrand_block(exponents, increments, count, re, im)
+ *                                 - evaluates the integrand at `count` consecutive points
+ *                                   of a run of the fastest-changing index; see below.
+ *
+ * get_fused_integrand_block(exponents, increments, count, re, im)
+ *                                 - the same for all values of hbar given to
+ *                                   tabulate_fused(), see block.cpp.
+ *
+ */
+
+/**
+ * @brief
+ * The struct grid_layout describes a traversal of the sample grid of the state integral.
+ *
+ * @remark
+ * The integrand depends on the grid point t only through the exponents L^T t mod samples.
+ * If the trimmed LTD matrix L has the Smith normal form U L V = D with elementary divisors
+ * d_i, then the substitution t = U^T s shows that the points s and s' give the same
+ * exponents iff s_i = s'_i mod samples/gcd(d_i, samples) for all i. Hence it suffices to
+ * let each index s_i run from 0 to extents[i] = samples/gcd(d_i, samples) and to count
+ * every point with the multiplicity prod_i gcd(d_i, samples).
+ *
+ * Row i of `increments` (reduced mod samples) is the change of the exponents caused by
+ * incrementing s_i by one. It also handles s_i wrapping around from extents[i]-1 to 0,
+ * since extents[i] times this row vanishes mod samples.
+ *
+ * If the multiplicity is 1, then U is replaced by the identity matrix, so that we
+ * traverse the original grid with extents[i] == samples and the rows of L as increments.
  */
+struct grid_layout
+{
+	std::vector<unsigned> extents;    // number of values taken by each index
+	std::vector<int> increments;      // num_quads exponent increments per index (flattened)
+	unsigned long long multiplicity;  // number of grid points represented by each point
+};
 
 /**
  * @brief The mani_data class stores information about a triangulated 3-manifold
@@ -57,9 +131,24 @@ private:
 	int nesting=1; // dimension of integration domain
 	int num_quads=6; // Number of quads
 	std::vector<int> LTD; // Leading-trailing matrix as a flattened vector
+	std::vector<long long> elementary_divisors; // of the first `nesting` rows of LTD
+	std::vector<long long> LTD_smith; // U*LTD, where U L V = D is the Smith normal form
 	std::vector<double> angles; //initial angle structure (in units of pi)
-	std::vector< std::shared_ptr<tabulation> > G_q_tables; // tabulated values of G_q
+	std::vector<double> table_angles; // the distinct angles; one table is computed for each
+	std::vector<int> table_of_quad; // the index of the table (and angle) of each quad
+	table_arena arena; // storage of the tabulated values of G_q
+	std::vector<table_view> tables; // the tabulated values of G_q, one table per quad
 	std::complex<double> prefactor; // [c(q)]^N
+	std::complex<double> hbar; // the parameter of the current tabulation
+	table_arena staging; // tables being computed in the background by prefetch_tabulation()
+	std::unique_ptr<tabulation_batch> staging_batch; // the threads computing them
+	std::complex<double> staging_hbar; // the parameter of the background tabulation
+	int staging_samples=0; // the number of samples of the background tabulation
+	table_arena fused; // interleaved tables for several values of hbar, see tabulate_fused()
+	std::vector<table_view> fused_tables; // views of `fused`; length samples * fused_width()
+	std::vector< std::complex<double> > fused_prefactors; // [c(q)]^N for each value of hbar
+	tabulation_method method=tabulation_method::product; // how the tables are computed
+	std::unique_ptr<table_cache> cache; // the cache of table files, if enabled
 	int k=1; // Number of cusps; currently always 1
 	int N=2; // Number of tetrahedra
 	bool valid_state=false, valid_tabulation=false; // state variables
@@ -67,19 +156,44 @@ private:
 	// private IO member functions
 	bool read_json(const char* filepath, Json::Value* root);
 	bool populate(const char* filepath);
+	void index_tables();
+	void smith_reduce();
+	bool finish_prefetch(std::complex<double> hbar, int samples);
+	std::complex<double> prefactor_at(std::complex<double> hbar) const;
 
 public:
 	// cdtors
 	mani_data(const char* filepath);
-	~mani_data() = default;
-	// Tabulation routine
+	~mani_data();
+	// Tabulation routines
 	void tabulate(std::complex<double> hbar, int samples);
+	void prefetch_tabulation(std::complex<double> hbar, int samples);
+	bool tabulate_fused(const std::vector< std::complex<double> >& hbars, int samples);
+	void refine_tabulation();
+	void set_tabulation_method(tabulation_method how);
+	void enable_table_cache(unsigned long long max_bytes);
+	// Layout of incremental traversals of the sample grid
+	grid_layout grid(int samples) const;
+	// Evaluation of the integrand at a run of consecutive points
+	void get_integrand_block(int* exponents, const int* increments, unsigned count,
+		double* re, double* im) const;
+	void get_fused_integrand_block(int* exponents, const int* increments, unsigned count,
+		double* re, double* im) const;
 	// Some inline getters:
 	inline unsigned int num_tetrahedra() const {return N;}
+	inline unsigned int num_quadrilaterals() const {return num_quads;}
+	inline unsigned int num_tables() const {return table_angles.size();}
+	inline int dimension() const {return nesting;}
+	inline int ltd_entry(int edge, int quad) const {return LTD[(num_quads*edge) + quad];}
+	inline double angle(int quad) const {return angles[quad];}
+	inline tabulation_method get_tabulation_method() const {return method;}
+	inline const table_view& table(int quad) const {return tables[quad];}
 	inline unsigned int num_cusps() const {return k;}
 	inline bool is_valid() const {return valid_state;}
 	inline bool ready() const {return (valid_state && valid_tabulation);}
 	inline std::complex<double> get_prefactor() const {return prefactor;}
+	inline unsigned int fused_width() const {return fused_prefactors.size();}
+	inline std::complex<double> get_fused_prefactor(int j) const {return fused_prefactors[j];}
 	// -------------------------------------------------------------------------
 	/**
 	 * @brief Computes the dot product with l(quad)
@@ -88,7 +202,7 @@ public:
 	 * @param quad - index of the quad
 	 * @return dot product of indices and the column of L at index `quad`
 	 */
-	inline int ltd_exponent(std::vector<unsigned int>& indices, int quad) const
+	inline int ltd_exponent(const std::vector<unsigned int>& indices, int quad) const
 	{
 		int sum = indices[0] * LTD[quad]; // edge == 0
 		for (int edge=1; edge<nesting; edge++)
@@ -100,11 +214,27 @@ public:
 	 * @brief
 	 * Computes the value of the integrand at the prescribed indices
 	 */
-	inline std::complex<double> get_integrand_value(std::vector<unsigned int>& indices) const
+	inline std::complex<double> get_integrand_value(const std::vector<unsigned int>& indices) const
+	{
+		std::complex<double> prod = tables[0].get(ltd_exponent(indices, 0));
+		for (int quad = 1; quad < num_quads; quad++)
+			prod *= tables[quad].get(ltd_exponent(indices, quad));
+		return prod;
+	}
+	// -------------------------------------------------------------------------
+	/**
+	 * @brief
+	 * Computes the value of the integrand at a point given by its exponents
+	 * @param exponents - array of num_quads exponents, each in the range [0, samples)
+	 * @remark
+	 * No reduction of the exponents takes place, so this is the fast path used
+	 * by the traversals which maintain the exponents incrementally.
+	 */
+	inline std::complex<double> get_integrand_value_at(const int* exponents) const
 	{
-		std::complex<double> prod = G_q_tables[0]->get(ltd_exponent(indices, 0));
+		std::complex<double> prod = tables[0].at(exponents[0]);
 		for (int quad = 1; quad < num_quads; quad++)
-			prod *= G_q_tables[quad]->get(ltd_exponent(indices, quad));
+			prod *= tables[quad].at(exponents[quad]);
 		return prod;
 	}
 };
@@ -0,0 +1,148 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#include <json/json.h>
+#include <complex>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "kahan.h"
+#include "merge.h"
+
+/**
+ * @file
+ * Implementation of the merging of shards
+ */
+// ================================================================================================
+/**
+ * @brief Reads a JSON packet from the file at `path`; returns false on failure
+ */
+bool read_shard(const std::string& path, Json::Value& packet)
+{
+	Json::CharReaderBuilder parser;
+	std::string error;
+	std::ifstream file(path, std::ifstream::in);
+	if (!file.good())
+	{
+		std::cerr << "Error: file '" << path << "' cannot be opened for reading!" << std::endl;
+		return false;
+	}
+	if (!Json::parseFromStream(parser, file, &packet, &error) || !packet.isObject())
+	{
+		std::cerr << "Error: file '" << path << "' does not contain valid JSON data!"
+			<< std::endl << "--- error details:" << std::endl << error << std::endl;
+		return false;
+	}
+	return true;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Combines the partial results of the shards in `packets`, which were read from the files
+ * `paths`, and stores the state integral in `integral`.
+ * @return true on success, false if the shards are malformed, belong to different
+ * computations, or do not cover all of the tiles exactly once.
+ */
+bool merge_shards(const std::vector<std::string>& paths, const std::vector<Json::Value>& packets,
+	std::complex<double>& integral)
+{
+	if (packets.empty())
+		return false;
+	// The values which must agree between all shards
+	const char* const common[] = {"count", "computation", "step_length",
+		"prefactor_real", "prefactor_imag"};
+	const Json::Value& reference = packets[0]["shard"];
+	const Json::Value& num_tiles = reference["computation"]["num_tiles"];
+	const Json::Value& count = reference["count"];
+	if (!reference.isObject() || !num_tiles.isUInt() || !count.isUInt())
+	{
+		std::cerr << "Error: file '" << paths[0] << "' does not contain a shard!" << std::endl;
+		return false;
+	}
+	std::vector<KN_accumulator> tile_sums(num_tiles.asUInt());
+	std::vector<bool> finished(num_tiles.asUInt(), false);
+	std::vector<bool> present(count.asUInt(), false);
+	for (std::size_t i = 0; i < packets.size(); i++)
+	{
+		const Json::Value& shard = packets[i]["shard"];
+		bool consistent = shard.isObject();
+		for (const char* key : common)
+			consistent = consistent && (canonical(shard[key]) == canonical(reference[key]));
+		if (!consistent)
+		{
+			std::cerr << "Error: the shard in '" << paths[i] << "' does not belong to the "
+				"same computation as the shard in '" << paths[0] << "'!" << std::endl;
+			return false;
+		}
+		const Json::Value& index = shard["index"];
+		if (!index.isUInt() || index.asUInt() >= present.size() || present[index.asUInt()])
+		{
+			std::cerr << "Error: the shard in '" << paths[i] << "' has an invalid or "
+				"repeated index!" << std::endl;
+			return false;
+		}
+		present[index.asUInt()] = true;
+		if (!decode_tile_sums(shard["tiles"], tile_sums, finished))
+		{
+			std::cerr << "Error: the shard in '" << paths[i] << "' contains invalid tiles!"
+				<< std::endl;
+			return false;
+		}
+	}
+	for (std::size_t index = 0; index < present.size(); index++)
+		if (!present[index])
+		{
+			std::cerr << "Error: the shard " << index << "/" << present.size()
+				<< " is missing!" << std::endl;
+			return false;
+		}
+	for (std::size_t tile = 0; tile < finished.size(); tile++)
+		if (!finished[tile])
+		{
+			std::cerr << "Error: the tile " << tile << " is missing from the shards!"
+				<< std::endl;
+			return false;
+		}
+
+	double step_length, prefactor_real, prefactor_imag;
+	if (!parse_hexadecimal(reference["step_length"], step_length)
+		|| !parse_hexadecimal(reference["prefactor_real"], prefactor_real)
+		|| !parse_hexadecimal(reference["prefactor_imag"], prefactor_imag))
+	{
+		std::cerr << "Error: the shards contain invalid factors!" << std::endl;
+		return false;
+	}
+	// Combine the tile sums in the same order as integrator::grid_sum()
+	KN_accumulator sum;
+	for (const auto& tile_sum : tile_sums)
+		sum += tile_sum;
+	integral = (step_length * std::complex<double>(sum))
+		* std::complex<double>(prefactor_real, prefactor_imag);
+	return true;
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
@@ -0,0 +1,53 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __MERGE_H__
+#define __MERGE_H__
+
+#include <json/json.h>
+#include <complex>
+#include <string>
+#include <vector>
+
+/**
+ * @file
+ * Combination of the partial results of `m3di integrate ... --shard i/n`.
+ *
+ * @remark
+ * Each shard sums a contiguous part of the tiles of the Riemann sum (see integrator.h)
+ * and prints a JSON packet whose object "shard" contains the states of the KN accumulators
+ * of its tiles, the description of the computation and the factors applied to the sum.
+ * Merging checks that the shards belong to the same computation and that together they
+ * contain every tile exactly once. The tile sums are then combined in tile order, exactly
+ * as in a single process, so the merged integral is identical to that of an unsharded run.
+ */
+
+// Reads a JSON packet from the file at `path`; returns false on failure
+bool read_shard(const std::string& path, Json::Value& packet);
+// Combines the shards; returns false if they are inconsistent or incomplete
+bool merge_shards(const std::vector<std::string>& paths, const std::vector<Json::Value>& packets,
+	std::complex<double>& integral);
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
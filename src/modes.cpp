@@ -4,12 +4,18 @@
  *   License information at the end of the file.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <thread>
+#include <vector>
 #include <cmath>
 #include "manifold.h"
+#include "chebyshev.h"
+#include "fused.h"
 #include "integrator.h"
+#include "merge.h"
 #include "write.h"
 #include "io.h"
 #include "stats.h"
@@ -48,50 +54,148 @@ program_mode decide_mode(int argc, const char** argv)
 		else
 			return program_mode::write;
 	}
+	else if (mode_string == MODE_SWEEP_STRING)
+	{
+		// for MODE_SWEEP, we expect 4 more positional params:
+		// infile, Re(hbar) values, Im(hbar) values, samples
+		if (argc < 4+2)
+			return program_mode::usage;
+		else
+			return program_mode::sweep;
+	}
+	else if (mode_string == MODE_MERGE_STRING)
+	{
+		// for MODE_MERGE, we expect at least one shard file
+		if (argc < 1+2)
+			return program_mode::usage;
+		else
+			return program_mode::merge;
+	}
+	else if (mode_string == MODE_INTERPOLATE_STRING)
+	{
+		// for MODE_INTERPOLATE, we expect 4 more positional params:
+		// infile, Re(hbar) segment, Im(hbar) segment, samples
+		if (argc < 4+2)
+			return program_mode::usage;
+		else
+			return program_mode::interpolate;
+	}
 	else if (mode_string == MODE_HELP_STRING_1 || mode_string == MODE_HELP_STRING_2)
 		return program_mode::help;
 	else
 		return program_mode::usage;
 }
 //==========================================================================================
+/**
+ * @brief
+ * Stores the value of the state integral in the `output` object
+ */
+static void fill_integral(Json::Value& output, std::complex<double> integral)
+{
+	// Check if the value of the integral is infinity or NaN
+	if (integral == INFTY)
+	{
+		output["real"] = output["imag"] = "infinity";
+	}
+	else if (std::isnan(integral.real()) || std::isnan(integral.imag()))
+	{
+		output["real"] = output["imag"] = "infinity or removable singularity";
+	}
+	else
+	{
+		output["real"] = integral.real();
+		output["imag"] = integral.imag();
+	}
+}
+//==========================================================================================
+/**
+ * @brief
+ * Applies the options --tabulation and --table-cache to the manifold data object
+ */
+static void configure_tabulation(mani_data& M, const args& cmdline)
+{
+	if (cmdline.tabulation == "fft")
+		M.set_tabulation_method(tabulation_method::fft);
+	else if (cmdline.tabulation == "reference")
+		M.set_tabulation_method(tabulation_method::reference);
+	if (cmdline.table_cache_size > 0)
+		M.enable_table_cache(static_cast<unsigned long long>(cmdline.table_cache_size * 1048576.0));
+}
+//==========================================================================================
+/**
+ * @brief
+ * Computes the state integral, with the refinement if requested on the command line,
+ * and stores the results in the `output` object
+ */
+static void run_integration(integrator& I, stats& St, const args& cmdline, Json::Value& output)
+{
+	if (cmdline.tolerance > 0)
+	{
+		refinement_result refinement = I.compute_refined_integral(St, cmdline.tolerance);
+		St.signal(stats::messages::finish_integration);
+		fill_integral(output, refinement.integral);
+		output["samples"] = refinement.samples;
+		output["error estimate"] = refinement.error_estimate;
+		output["converged"] = refinement.converged;
+	}
+	else
+	{
+		std::complex<double> integral = I.compute_integral(St);
+		St.signal(stats::messages::finish_integration);
+		fill_integral(output, integral);
+	}
+}
+//==========================================================================================
 /**
  * @brief
  * Implements the integration mode, which is the main mode of the program.
  */
-int integrate_mode(const char** argv)
+int integrate_mode(int argc, const char** argv)
 {
 	// Get command line parameters:
-	auto cmdline = args(argv);
+	auto cmdline = args(argc, argv);
 	if (!cmdline.valid)
 		return 1;
-	auto M = mani_data(cmdline.filepath);
+	mani_data M(cmdline.filepath);
 	if (!M.is_valid())
 	{
 		std::cerr << "No valid triangulation data provided!" << std::endl;
 		return 1;
 	}
+	configure_tabulation(M, cmdline);
 	// ==== Compute the state integral of the meromorphic 3D-index ====
 	stats St; // stats object to keep track of computation time
-	integrator I(M, cmdline.hbar, cmdline.samples);
+	auto engine = (cmdline.engine == "fourier")?
+		integration_engine::fourier : integration_engine::riemann;
+	integrator I(M, cmdline.hbar, cmdline.samples, engine, cmdline.kernel == "jit");
+	if (cmdline.shard_count > 0)
+		I.set_shard(cmdline.shard_index, cmdline.shard_count);
+	if (!cmdline.checkpoint_path.empty()
+		&& !I.set_checkpoint(cmdline.checkpoint_path, cmdline.resume, cmdline.checkpoint_interval))
+		return 1;
 	St.signal(stats::messages::begin_computation);
-	auto integral = I.compute_integral(St);
-	St.signal(stats::messages::finish_integration);
-	// ==== Format output ====
-	Json::Value packet, input, output, statistics;
-	// Check if the returned value of the integral is infinity or NaN
-	if (integral == INFTY)
-	{
-		output["real"] = output["imag"] = "infinity";
-	}
-	else if (std::isnan(integral.real()) || std::isnan(integral.imag()))
+	if (cmdline.shard_count > 0)
 	{
-		output["real"] = output["imag"] = "infinity or removable singularity";
-	}
-	else
-	{
-		output["real"] = integral.real();
-		output["imag"] = integral.imag();
+		// Compute a part of the Riemann sum, to be combined in merge mode
+		Json::Value shard = I.compute_shard(St);
+		St.signal(stats::messages::finish_integration);
+		if (shard.isNull())
+		{
+			std::cerr << "Error while computing integrand values." << std::endl;
+			return 1;
+		}
+		Json::Value packet, input, statistics;
+		cmdline.fill(input);
+		St.fill(statistics);
+		packet["input"] = input;
+		packet["shard"] = shard;
+		packet["statistics"] = statistics;
+		print_json(&(std::cout), packet);
+		return 0;
 	}
+	Json::Value packet, input, output, statistics;
+	run_integration(I, St, cmdline, output);
+	// ==== Format output ====
 	// Fill out the objects 'input' and 'statistics'
 	cmdline.fill(input);
 	St.fill(statistics);
@@ -108,17 +212,18 @@ int integrate_mode(const char** argv)
  * @brief
  * Implements the write mode, which outputs the integrand values as JSON data
  */
-int write_mode(const char** argv)
+int write_mode(int argc, const char** argv)
 {
-	auto cmdline = args(argv);
+	auto cmdline = args(argc, argv);
 	if (!cmdline.valid)
 		return 1;
-	auto M = mani_data(cmdline.filepath);
+	mani_data M(cmdline.filepath);
 	if (!M.is_valid())
 	{
 		std::cerr << "No valid triangulation data provided!" << std::endl;
 		return 1;
 	}
+	configure_tabulation(M, cmdline);
 	// M is OK, we launch precomputation
 	M.tabulate(cmdline.hbar, cmdline.samples);
 	if (!M.ready())
@@ -126,14 +231,266 @@ int write_mode(const char** argv)
 		std::cerr << "Error while computing integrand values." << std::endl;
 		return 1;
 	}
-	// Create JSON representation of output
-	Json::Value output, input, packet;
+	sample_selection selection(M.num_tetrahedra() - M.num_cusps(), cmdline.samples);
+	if (!selection.restrict(cmdline.slice, cmdline.decimation, cmdline.marginal))
+		return 1;
+	Json::Value input;
 	cmdline.fill(input);
-	// Compute the integrand values and store them in output
-	store_integrand_values(output, M, cmdline.samples);
+	// Compute the integrand values and write them out point by point
+	bool written;
+	if (cmdline.format != "json")
+	{
+		// A binary array, described by the sidecar file <output>.json
+		std::ofstream file(cmdline.output_path, std::ios::binary);
+		written = file && write_integrand_array(file, M, cmdline.samples, selection,
+			cmdline.format == "npy");
+		if (written)
+		{
+			file.close();
+			written = !file.fail();
+		}
+		Json::Value packet, output;
+		describe_integrand_array(output, selection);
+		output["format"] = cmdline.format;
+		output["file"] = cmdline.output_path;
+		packet["input"] = input;
+		packet["output"] = output;
+		std::ofstream sidecar(cmdline.output_path + ".json");
+		print_json(&sidecar, packet);
+		sidecar.close();
+		written = written && !sidecar.fail();
+	}
+	else if (cmdline.output_path.empty())
+		written = write_integrand_values(std::cout, input, M, cmdline.samples, selection);
+	else
+	{
+		std::ofstream file(cmdline.output_path, std::ios::binary);
+		written = file && write_integrand_values(file, input, M, cmdline.samples, selection);
+		if (written)
+		{
+			file.close();
+			written = !file.fail();
+		}
+	}
+	if (!written)
+	{
+		std::cerr << "Error while writing the integrand values";
+		if (!cmdline.output_path.empty())
+			std::cerr << " to '" << cmdline.output_path << "'";
+		std::cerr << "." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+//==========================================================================================
+/**
+ * @brief
+ * Performs a sweep with the option --fuse, where the integrals for groups of values of
+ * hbar are computed together in a single traversal of the grid (see fused.h)
+ */
+static int fused_sweep(mani_data& M, args& cmdline,
+	const std::vector< std::complex<double> >& points)
+{
+	for (std::size_t first = 0; first < points.size(); first += cmdline.fuse)
+	{
+		const std::size_t end = std::min(first + cmdline.fuse, points.size());
+		const std::vector< std::complex<double> > group(points.begin() + first,
+			points.begin() + end);
+		stats St;
+		fused_integrator F(M, group, cmdline.samples);
+		St.signal(stats::messages::begin_computation);
+		std::vector< std::complex<double> > integrals = F.compute_integrals(St);
+		St.signal(stats::messages::finish_integration);
+		if (integrals.size() != group.size())
+		{
+			std::cerr << "Error while computing integrand values." << std::endl;
+			return 1;
+		}
+		for (std::size_t j = 0; j < group.size(); j++)
+		{
+			Json::Value packet, input, output, statistics;
+			cmdline.set_hbar(group[j].real(), group[j].imag());
+			cmdline.fill(input);
+			fill_integral(output, integrals[j]);
+			St.fill(statistics);
+			statistics["fused values"] = static_cast<unsigned>(group.size());
+			packet["input"] = input;
+			packet["output"] = output;
+			packet["statistics"] = statistics;
+			print_json_line(&(std::cout), packet);
+		}
+	}
+	return 0;
+}
+//==========================================================================================
+/**
+ * @brief
+ * Implements the sweep mode, which computes the state integral for a list of values
+ * of hbar and prints one line of JSON data per value (the JSON Lines format)
+ * @remark
+ * The triangulation is read only once. While the integral for one value of hbar is
+ * computed, the factors of the integrand for the next value are tabulated in the
+ * background (see mani_data::prefetch_tabulation), so the integration threads
+ * hardly ever wait for the tabulation.
+ */
+int sweep_mode(int argc, const char** argv)
+{
+	auto cmdline = args(argc, argv);
+	if (!cmdline.valid)
+		return 1;
+	mani_data M(cmdline.filepath);
+	if (!M.is_valid())
+	{
+		std::cerr << "No valid triangulation data provided!" << std::endl;
+		return 1;
+	}
+	configure_tabulation(M, cmdline);
+	auto engine = (cmdline.engine == "fourier")?
+		integration_engine::fourier : integration_engine::riemann;
+	std::vector< std::complex<double> > points;
+	for (double Rehbar : cmdline.re_values)
+		for (double Imhbar : cmdline.im_values)
+			points.emplace_back(Rehbar, Imhbar);
+	if (cmdline.fuse > 1)
+		return fused_sweep(M, cmdline, points);
+	// With a single hardware thread, the background tabulation would only compete
+	// with the integration
+	const bool prefetch = (std::thread::hardware_concurrency() > 1);
+	for (std::size_t i = 0; i < points.size(); i++)
+	{
+		stats St;
+		cmdline.set_hbar(points[i].real(), points[i].imag());
+		integrator I(M, points[i], cmdline.samples, engine, cmdline.kernel == "jit");
+		St.signal(stats::messages::begin_computation);
+		M.tabulate(points[i], cmdline.samples); // normally prefetched already
+		if (prefetch && i + 1 < points.size())
+			M.prefetch_tabulation(points[i+1], cmdline.samples);
+		Json::Value packet, input, output, statistics;
+		run_integration(I, St, cmdline, output);
+		cmdline.fill(input);
+		St.fill(statistics);
+		packet["input"] = input;
+		packet["output"] = output;
+		packet["statistics"] = statistics;
+		print_json_line(&(std::cout), packet);
+	}
+	return 0;
+}
+//==========================================================================================
+/**
+ * @brief
+ * Implements the merge mode, which combines the partial results of
+ * `integrate ... --shard i/n` into the state integral
+ */
+int merge_mode(int argc, const char** argv)
+{
+	std::vector<std::string> paths;
+	std::vector<Json::Value> packets;
+	for (int i = 2; i < argc; i++)
+	{
+		paths.emplace_back(argv[i]);
+		packets.emplace_back();
+		if (!read_shard(paths.back(), packets.back()))
+			return 1;
+	}
+	std::complex<double> integral;
+	if (!merge_shards(paths, packets, integral))
+		return 1;
+	// ==== Format output ====
+	Json::Value packet, input, output, statistics, shard_statistics(Json::arrayValue);
+	input = packets[0]["input"];
+	if (input.isMember("options"))
+	{
+		input["options"].removeMember("shard");
+		if (input["options"].empty())
+			input.removeMember("options");
+	}
+	fill_integral(output, integral);
+	for (const Json::Value& shard : packets)
+		shard_statistics.append(shard["statistics"]);
+	statistics["shards"] = static_cast<unsigned>(packets.size());
+	statistics["shard statistics"] = shard_statistics;
+	packet["input"] = input;
+	packet["output"] = output;
+	packet["statistics"] = statistics;
+	print_json(&(std::cout), packet);
+	return 0;
+}
+//==========================================================================================
+/**
+ * @brief
+ * Implements the interpolate mode, which samples the state integral adaptively along
+ * a segment of values of hbar and fits a piecewise Chebyshev interpolant (see chebyshev.h)
+ */
+int interpolate_mode(int argc, const char** argv)
+{
+	auto cmdline = args(argc, argv);
+	if (!cmdline.valid)
+		return 1;
+	mani_data M(cmdline.filepath);
+	if (!M.is_valid())
+	{
+		std::cerr << "No valid triangulation data provided!" << std::endl;
+		return 1;
+	}
+	configure_tabulation(M, cmdline);
+	const std::complex<double> from(cmdline.re_values[0], cmdline.im_values[0]);
+	const std::complex<double> to(cmdline.re_values[1], cmdline.im_values[1]);
+	stats St;
+	chebyshev_sampler sampler(M, from, to, cmdline.samples, cmdline.interpolation_tolerance,
+		cmdline.fuse);
+	if (!sampler.run(St))
+		return 1;
+	// ==== Format output ====
+	Json::Value packet, input, output, statistics;
+	Json::Value values(Json::arrayValue), pieces(Json::arrayValue);
+	cmdline.fill(input);
+	input.removeMember("hbar_real");
+	input.removeMember("hbar_imag");
+	input["hbar_from_real"] = from.real();
+	input["hbar_from_imag"] = from.imag();
+	input["hbar_to_real"] = to.real();
+	input["hbar_to_imag"] = to.imag();
+	input["interpolation tolerance"] = cmdline.interpolation_tolerance;
+	for (const auto& entry : sampler.values())
+	{
+		Json::Value value;
+		value["hbar_real"] = sampler.hbar(entry.first).real();
+		value["hbar_imag"] = sampler.hbar(entry.first).imag();
+		fill_integral(value, entry.second);
+		values.append(value);
+	}
+	bool converged = true;
+	for (const chebyshev_piece& piece : sampler.pieces())
+	{
+		Json::Value object, real(Json::arrayValue), imag(Json::arrayValue);
+		object["from_real"] = piece.from.real();
+		object["from_imag"] = piece.from.imag();
+		object["to_real"] = piece.to.real();
+		object["to_imag"] = piece.to.imag();
+		for (const std::complex<double>& c : piece.coefficients)
+		{
+			real.append(c.real());
+			imag.append(c.imag());
+		}
+		object["coefficients_real"] = real;
+		object["coefficients_imag"] = imag;
+		if (std::isfinite(piece.error_estimate))
+			object["error estimate"] = piece.error_estimate;
+		else
+			object["error estimate"] = "infinity";
+		object["converged"] = piece.converged;
+		converged = converged && piece.converged;
+		pieces.append(object);
+	}
+	output["values"] = values;
+	output["pieces"] = pieces;
+	output["converged"] = converged;
+	St.fill(statistics);
+	statistics["integrations"] = static_cast<unsigned>(sampler.values().size());
 	packet["input"] = input;
 	packet["output"] = output;
-	// Output data; TODO: implement output to file instead of std::cout
+	packet["statistics"] = statistics;
 	print_json(&(std::cout), packet);
 	return 0;
 }
@@ -152,6 +509,9 @@ int display_usage(int argc, const char** argv)
 		 << "Avaliable modes are:" << endl
 		 << MODE_INTEGRATE_STRING << endl
 		 << MODE_WRITE_STRING << endl
+		 << MODE_SWEEP_STRING << endl
+		 << MODE_MERGE_STRING << endl
+		 << MODE_INTERPOLATE_STRING << endl
 		 << MODE_HELP_STRING_1 << endl << endl
 		 << "Type \"" << executable << " "
 		 << MODE_HELP_STRING_1 << "\" for help." << endl;
@@ -176,7 +536,7 @@ executable <<
 "integrate\n"
 "          The integrate command is used to compute the total meromorphic 3D-index.\n"
 "          The syntax for this mode is:\n"
-"              " << executable << " integrate <file> <Re_hbar> <Im_hbar> <samples>\n"
+"              " << executable << " integrate <file> <Re_hbar> <Im_hbar> <samples> [options]\n"
 "          The meaning of the parameters is as follows:\n"
 "          <file>    - Path to a JSON file containing combinatorial information\n"
 "                      about the triangulated 3-manifold.\n"
@@ -186,13 +546,132 @@ executable <<
 "                      taken in each iterated integral. A higher sample count generally\n"
 "                      results in a higher accuracy of the result but also in a slower\n"
 "                      computation. For q not too close to the boundary of the unit disc,\n"
-"                      a value of <samples> in the range 5000 to 10000 usually suffices.\n\n"
+"                      a value of <samples> in the range 5000 to 10000 usually suffices.\n"
+"          Optional parameters may follow the positional ones:\n"
+"          --engine riemann|fourier\n"
+"                    - Selects how the Riemann sum over the sample grid is evaluated.\n"
+"                      The default engine 'riemann' sums the integrand over the grid.\n"
+"                      The engine 'fourier' instead sums products of the truncated\n"
+"                      Fourier coefficients of the factors of the integrand; this is\n"
+"                      much faster when <samples> is large compared to the number of\n"
+"                      relevant Fourier modes. The sum is computed twice, with different\n"
+"                      truncations and rounding errors, and if the two results differ by\n"
+"                      more than 1e-9 relative to their size, which happens when |hbar|\n"
+"                      is small, the engine 'riemann' is used instead.\n"
+"          --kernel builtin|jit\n"
+"                    - Selects the code summing the integrand in the 'riemann' engine.\n"
+"                      With 'jit', a kernel specialized to the triangulation is generated,\n"
+"                      compiled by the system C++ compiler (the variable CXX, or c++) and\n"
+"                      cached in $M3DI_CACHE, $XDG_CACHE_HOME/m3di or ~/.cache/m3di.\n"
+"                      This pays off for long computations. The result is identical.\n"
+"          --tabulation product|reference|fft\n"
+"                    - Selects how the factors G_q of the integrand are tabulated.\n"
+"                      With the default 'product', each value is computed from the\n"
+"                      infinite product, truncated where the neglected factors change\n"
+"                      it by less than 1e-17 relative to its value; this is slow for |q|\n"
+"                      close to 1. With 'reference', all factors are multiplied until\n"
+"                      q^n underflows, as in earlier versions (about 18 times slower).\n"
+"                      With 'fft', the values on each circle are computed at once from\n"
+"                      the Laurent series of log G_q by a fast Fourier transform; the\n"
+"                      time hardly depends on q and the values agree up to rounding\n"
+"                      errors. This option is supported in all modes.\n"
+"          --table-cache <megabytes>\n"
+"                    - Stores the tabulated factors in files in $M3DI_CACHE (see --kernel)\n"
+"                      and reuses them in later runs with the same hbar, samples and\n"
+"                      tabulation method. The files are shared by concurrent processes\n"
+"                      without copying. The least recently used files are deleted when\n"
+"                      the cache exceeds the given size. Supported in all modes.\n"
+"          --tol <tolerance>\n"
+"                    - Computes the integral with <samples>, 2*<samples>, 4*<samples>, ...\n"
+"                      samples, until two consecutive results agree up to the relative\n"
+"                      <tolerance>. Every grid reuses the points of the previous one.\n"
+"                      The final number of samples and the difference between the last\n"
+"                      two results are reported in the output.\n"
+"          --checkpoint <path>\n"
+"                    - Saves the partial sums computed so far to the file <path>\n"
+"                      periodically and at the end of the integration (not with --tol).\n"
+"          --resume <path>\n"
+"                    - Like --checkpoint, but if <path> exists, the integration continues\n"
+"                      from the partial sums saved there. The result is identical to that\n"
+"                      of an uninterrupted integration.\n"
+"          --checkpoint-interval <seconds>\n"
+"                    - The time between two checkpoints; the default is 300 seconds.\n"
+"          --shard <i>/<n>\n"
+"                    - Computes only the part <i> (counting from 0) of <n> equal parts\n"
+"                      of the integral and prints it, together with the data needed for\n"
+"                      combining the parts in merge mode (not with --tol).\n\n"
 "write\n"
 "          This command does not compute the state integral, but rather writes out sampled\n"
 "          values of the integrand as JSON data to the standard output.\n"
 "          The syntax for this mode is:\n"
-"              " << executable << " write <file> <Re_hbar> <Im_hbar> <samples>\n"
-"          The meaning of the parameters is identical as in the integrate mode.\n\n";
+"              " << executable << " write <file> <Re_hbar> <Im_hbar> <samples> [options]\n"
+"          The meaning of the parameters is identical as in the integrate mode.\n"
+"          The options --tabulation and --table-cache are supported. Further options:\n"
+"          --output <path>\n"
+"                    - Writes the data to the given file instead of the standard output.\n"
+"                      The points are written as they are computed, so the memory usage\n"
+"                      does not depend on the number of points.\n"
+"          --format json|npy|raw\n"
+"                    - With 'npy' or 'raw', the values are written to the file given by\n"
+"                      --output as a dense complex128 array of shape (S, ..., S) with\n"
+"                      N-1 axes in Fortran order (the first index changes fastest), with\n"
+"                      or without a NumPy header. The input and the layout of the array\n"
+"                      are described in the JSON file <path>.json. The default is 'json'.\n"
+"          --slice <i_1>,...,<i_d>\n"
+"                    - Writes only the points with the given indices (from 0 to\n"
+"                      samples-1) along the axes for which an index is given; an entry\n"
+"                      '*' leaves the axis free. E.g. '*,*,7' is a plane through the\n"
+"                      points with the third index equal to 7.\n"
+"          --decimate <k>\n"
+"                    - Takes only the indices 0, k, 2k, ... along the free axes.\n"
+"          --marginal <a_1>,...\n"
+"                    - Keeps only the given axes (numbered from 1) and writes the means\n"
+"                      of the integrand over the other axes, whose mean in turn is the\n"
+"                      state integral; the coordinates \"t\" are those of the kept axes.\n"
+"                      Not together with --slice.\n\n"
+"sweep\n"
+"          This command computes the state integral for many values of hbar, printing\n"
+"          one line of JSON data per value as soon as it is available (JSON Lines).\n"
+"          The syntax for this mode is:\n"
+"              " << executable << " sweep <file> <Re_hbar> <Im_hbar> <samples> [options]\n"
+"          where each of <Re_hbar> and <Im_hbar> is either a list of numbers separated\n"
+"          by commas, such as -0.1,-0.2,-0.5, or a range <from>:<to>:<count> of <count>\n"
+"          equally spaced numbers, such as -1:-0.1:10. All combinations of the values\n"
+"          are computed. The options --engine, --kernel, --tabulation, --table-cache and\n"
+"          --tol of the integrate mode are supported. Each line has the same format as\n"
+"          the output of integrate.\n"
+"          Additional options:\n"
+"          --fuse <K>\n"
+"                    - Computes the integrals for K consecutive values of hbar (at most 16)\n"
+"                      together, in a single pass over the sample grid. This is faster\n"
+"                      than K separate passes, and the results are identical. It is not\n"
+"                      supported with --tol, --kernel jit or the engine 'fourier'.\n\n"
+"merge\n"
+"          This command combines the parts of an integral computed with the option --shard\n"
+"          and prints the result in the same format as the integrate mode.\n"
+"          The syntax for this mode is:\n"
+"              " << executable << " merge <shard file> [<shard file> ...]\n"
+"          Each file contains the output of one part. All of the parts must be given.\n\n"
+"interpolate\n"
+"          This command computes the state integral along a segment of values of hbar\n"
+"          and approximates it by a piecewise Chebyshev interpolant, using as few\n"
+"          integrations as the requested accuracy allows.\n"
+"          The syntax for this mode is:\n"
+"              " << executable << " interpolate <file> <Re_hbar> <Im_hbar> <samples> [options]\n"
+"          where each of <Re_hbar> and <Im_hbar> is either a segment <from>:<to>, such as\n"
+"          -0.9:-0.1, or a single number. The integral is computed at Chebyshev points;\n"
+"          where the estimated interpolation error exceeds the tolerance, the degree is\n"
+"          raised (reusing all points computed before) up to 256, and then the segment is\n"
+"          split in halves. The output contains all of the computed values as well as the\n"
+"          Chebyshev coefficients of the interpolant on each piece of the segment.\n"
+"          The options --tabulation and --table-cache of the integrate mode are supported.\n"
+"          Additional options:\n"
+"          --interpolation-tol <tolerance>\n"
+"                    - The relative tolerance of the interpolation; the default is 1e-8.\n"
+"                      It should exceed the accuracy of the integrals themselves.\n"
+"          --fuse <K>\n"
+"                    - How many new points are computed in a single pass over the sample\n"
+"                      grid (at most 16), as in sweep mode; the default is 8.\n\n";
 	return 0;
 }
 //==========================================================================================
@@ -24,15 +24,21 @@
  *
  */
 
-enum class program_mode {integrate, write, usage, help};
+enum class program_mode {integrate, write, sweep, merge, interpolate, usage, help};
 const std::string MODE_INTEGRATE_STRING {"integrate"};
 const std::string MODE_HELP_STRING_1    {"help"};
 const std::string MODE_HELP_STRING_2    {"--help"};
 const std::string MODE_WRITE_STRING     {"write"};
+const std::string MODE_SWEEP_STRING     {"sweep"};
+const std::string MODE_MERGE_STRING     {"merge"};
+const std::string MODE_INTERPOLATE_STRING {"interpolate"};
 
 program_mode decide_mode(int argc, const char** argv);
-int integrate_mode(const char** argv);
-int write_mode(const char** argv);
+int integrate_mode(int argc, const char** argv);
+int write_mode(int argc, const char** argv);
+int sweep_mode(int argc, const char** argv);
+int merge_mode(int argc, const char** argv);
+int interpolate_mode(int argc, const char** argv);
 
 int display_usage(int argc, const char** argv);
 int display_help(int argc, const char** argv);
@@ -0,0 +1,114 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+
+#include "scheduler.h"
+
+/**
+ * @file
+ * Implementation of the work-stealing scheduler `tile_scheduler`
+ */
+// ================================================================================================
+/**
+ * @brief
+ * Constructor of class `tile_scheduler`; splits the tiles evenly between the workers.
+ */
+tile_scheduler::tile_scheduler(unsigned num_tiles, unsigned workers) :
+	num_workers {(workers > 0)? workers : 1},
+	queues {new queue[num_workers]}
+{
+	for (unsigned w = 0; w < num_workers; w++)
+	{
+		queues[w].next = static_cast<unsigned>(
+			(static_cast<unsigned long long>(num_tiles) * w) / num_workers);
+		queues[w].end  = static_cast<unsigned>(
+			(static_cast<unsigned long long>(num_tiles) * (w+1)) / num_workers);
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Obtains the next tile to be processed by the given worker.
+ * @return true if a tile was stored in `tile`, false if all tiles have been handed out.
+ */
+bool tile_scheduler::acquire(unsigned worker, unsigned& tile)
+{
+	queue& own = queues[worker];
+	do
+	{
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (own.next < own.end)
+		{
+			tile = own.next++;
+			return true;
+		}
+	} while (steal(worker));
+	return false;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Moves the back half of the largest range of another worker into the queue of `thief`.
+ * @return true on success, false if there was nothing left to steal.
+ */
+bool tile_scheduler::steal(unsigned thief)
+{
+	for (;;)
+	{
+		// Find the victim with the most remaining work
+		unsigned victim = thief;
+		unsigned most = 0;
+		for (unsigned w = 0; w < num_workers; w++)
+		{
+			if (w == thief)
+				continue;
+			std::lock_guard<std::mutex> guard(queues[w].lock);
+			unsigned remaining = queues[w].end - queues[w].next;
+			if (remaining > most)
+			{
+				most = remaining;
+				victim = w;
+			}
+		}
+		if (most == 0)
+			return false;
+		// Take the back half of the victim's range (or its last tile)
+		unsigned from, to;
+		{
+			std::lock_guard<std::mutex> guard(queues[victim].lock);
+			queue& v = queues[victim];
+			if (v.next >= v.end)
+				continue; // the victim finished meanwhile; look again
+			to = v.end;
+			from = v.end - (v.end - v.next + 1)/2;
+			v.end = from;
+		}
+		std::lock_guard<std::mutex> guard(queues[thief].lock);
+		queues[thief].next = from;
+		queues[thief].end = to;
+		return true;
+	}
+}
+// ================================================================================================
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
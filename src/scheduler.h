@@ -0,0 +1,74 @@
+/*
+ *   Copyright (C) 2021 Rafael M. Siejakowski.
+ *   All rights reserved.
+ *   License information at the end of the file.
+ */
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <memory>
+#include <mutex>
+
+/**
+ * @class
+ * A work-stealing scheduler distributing a range of tiles between worker threads
+ *
+ * @remark
+ * The tiles 0, 1, ..., num_tiles-1 are initially split into contiguous ranges,
+ * one per worker. Each worker takes tiles from the front of its own range.
+ * Once its range is exhausted, the worker steals the back half of the largest
+ * remaining range of another worker. This keeps all workers busy until the
+ * very end, even if some tiles take much longer than others, while each worker
+ * still processes mostly contiguous tiles.
+ *
+ * Public member functions:
+ *
+ * tile_scheduler(num_tiles, num_workers) - class constructor
+ *
+ * bool acquire(worker, tile)             - stores the next tile to be processed by
+ *                                          `worker` in `tile`. Returns false when
+ *                                          there are no tiles left.
+ *
+ */
+class tile_scheduler
+{
+	private:
+	struct queue
+	{
+		std::mutex lock;
+		unsigned next {0}; // first tile of the range
+		unsigned end {0};  // one past the last tile of the range
+		char padding[64];  // keeps the queues in separate cache lines
+	};
+	unsigned num_workers;
+	std::unique_ptr<queue[]> queues; // one queue for each worker
+
+	bool steal(unsigned thief);
+
+	public:
+	tile_scheduler(unsigned num_tiles, unsigned workers);
+	~tile_scheduler() = default;
+	bool acquire(unsigned worker, unsigned& tile);
+};
+
+#endif
+/*
+ *
+ * Copyright (C) 2021 Rafael M. Siejakowski
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation;
+ * later versions of the GNU General Public Licence do NOT apply.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
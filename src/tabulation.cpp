@@ -4,111 +4,387 @@
  *   License information at the end of the file.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <complex>
+#include <cfloat>
+#include <cmath>
+#include <vector>
 
+#include "fft.h"
 #include "tabulation.h"
 
+// Largest number of Laurent coefficients summed by the method `fft`, beyond which the
+// circle is too close to the boundary of the annulus and `product` is used instead
+constexpr double MAX_LAURENT_TERMS = 1 << 24;
+// Parameters of the division of a tabulation_batch into chunks
+constexpr long long CHUNKS_PER_THREAD = 4;
+constexpr long long MIN_CHUNK_LENGTH = 64;
+// Number of values computed at once by compute_products(), and the number of blocks of
+// values after which the sample points are recomputed exactly instead of rotated
+constexpr int TABULATION_LANES = 8;
+constexpr int TABULATION_RENORM = 16;
+
 /**
  * @file
- * Implementation of member functions of class 'tabulation'
+ * Implementation of member functions of the classes 'tabulation' and 'tabulation_batch'
 */
 // ================================================================================================
 /**
  * @brief
- * Constructs the object and immediately launches the tabulation
+ * Returns the name of the method, as given to the option --tabulation
 */
-tabulation::tabulation(double initial_a, std::complex<double> hbar, int samples):
-	length {samples}, ready {false}, iteration {nullptr}
+const char* tabulation_method_name(tabulation_method how)
+{
+	switch (how)
+	{
+		case tabulation_method::reference: return "reference";
+		case tabulation_method::fft: return "fft";
+		default: return "product";
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Constructs the object; the values are computed by compute()
+*/
+tabulation::tabulation(double initial_a, std::complex<double> hbar, int samples,
+	double* real_parts, double* imag_parts, int first_index, int index_stride,
+	int value_spacing, tabulation_method how):
+	re {real_parts}, im {imag_parts}, hbar {hbar}, length {samples}, first {first_index},
+	stride {(index_stride > 0)? index_stride : 1},
+	spacing {(value_spacing > 0)? value_spacing : 1}, method {how}
 {
-	if (length < 1)
-		return;
 	//Initialize variables needed for the tabulation
-	step = twopi / static_cast<double>(length);
-	buffer.reserve(length);
+	step = twopi / static_cast<double>((length > 0)? length : 1);
 	q = std::exp(hbar);
 	startangle = initial_a * π;
 	radius = std::exp(hbar * initial_a);
-	bool is_real = (hbar.imag() == 0);
-	// Everything is set up, so we can start the precomputation thread:
-	iteration = std::make_unique<std::thread>(thread_main, this, is_real);
+	log_start = hbar * initial_a + std::complex<double>(0.0, startangle);
+	factors = G_q_factors(std::abs(q), std::abs(radius));
+	if (method == tabulation_method::reference)
+		return;
+	// The powers q^n, n = 1, ..., factors, shared by all of the points
+	power_re.resize(factors);
+	power_im.resize(factors);
+	std::complex<double> q_to_n = q;
+	for (int n = 0; n < factors; n++)
+	{
+		power_re[n] = q_to_n.real();
+		power_im[n] = q_to_n.imag();
+		q_to_n *= q;
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Returns the number of values to compute, i.e., of indices first + i*stride < length
+*/
+int tabulation::count() const
+{
+	return (first < length)? (length - first + stride - 1) / stride : 0;
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Computes the values number begin, ..., end-1 of the sequence. With the method `fft`,
+ * the whole sequence is computed at once, see laurent_circle().
+*/
+void tabulation::compute(int begin, int end)
+{
+	if (method == tabulation_method::fft && laurent_circle())
+		return;
+	compute_products(begin, end);
 }
 // ------------------------------------------------------------------------------------------------
 /**
  * @brief
- * A static member function serving as the thread main for the tabulation thread.
- * @param
- * real_q - informs us whether the parameter hbar is real.
+ * Computes the values number begin, ..., end-1 of the sequence from the infinite products,
+ * truncated after the given number of factors.
  * @remark
- * Note that when hbar is real, then q and "radius" are also real,
- * and this speeds up computations.
+ * The values are computed TABULATION_LANES at a time: the arrays indexed by the lane hold
+ * the real and imaginary parts of the sample points z, of 1/z and of the partial products,
+ * and the loop over the lanes is vectorized by the compiler. The powers q^n, which are
+ * the same for all points, are precomputed by the constructor.
+ *
+ * Instead of a sine and a cosine per point, the unit vectors z/|z| are computed exactly
+ * only for the first block of every TABULATION_RENORM blocks, counted from the index 0 so
+ * that the values do not depend on the chunks computed by the threads. The following
+ * blocks are obtained from it by the rotations exp(i*step*stride*lanes*m), computed once
+ * per call, so that each unit vector carries the rounding error of a single rotation:
+ * since the phase error is multiplied by z G_q'(z)/G_q(z), which is large for |q| close
+ * to 1, a recurrence from block to block would lose several digits.
+ * When hbar is real, then q^n and "radius" are also real, and the cheaper loop is used.
 */
-void tabulation::thread_main(tabulation* obj, bool real_q)
+void tabulation::compute_products(int begin, int end)
 {
-	double alpha = obj->startangle;
-	double step = obj->step;
-	int len = obj->length;
-	if (real_q)
+	if (method == tabulation_method::reference)
+	{
+		compute_reference(begin, end);
+		return;
+	}
+	if (begin >= end)
+		return;
+	constexpr int lanes = TABULATION_LANES;
+	constexpr int period = TABULATION_LANES * TABULATION_RENORM;
+	const double r = std::abs(radius);
+	const double alpha = startangle + std::arg(radius);
+	const double angle_step = step * static_cast<double>(stride);
+	// The rotation by (rotation_re[m], rotation_im[m]) takes the points of a block to
+	// those of the block m blocks further
+	double rotation_re[TABULATION_RENORM], rotation_im[TABULATION_RENORM];
+	for (int m = 0; m < TABULATION_RENORM; m++)
+	{
+		const std::complex<double> rotation = std::polar(1.0, angle_step * (m * lanes));
+		rotation_re[m] = rotation.real();
+		rotation_im[m] = rotation.imag();
+	}
+	const bool real_q = (hbar.imag() == 0);
+
+	double er[lanes] = {}, ei[lanes] = {}; // the unit vectors z/|z| of the last exact block
+	double ur[lanes], ui[lanes]; // the unit vectors z/|z| of the current block
+	double nr[lanes], ni[lanes]; // the numerators
+	double dr[lanes], di[lanes]; // the denominators
+	// Starts at the block containing `begin`
+	int block = begin - (begin % lanes);
+	for (; block < end; block += lanes)
+	{
+		if (block % period == 0 || block < begin + lanes) // the first block is always exact
+			for (int l = 0; l < lanes; l++)
+			{
+				const int exact = block - (block % period);
+				const std::complex<double> u = std::polar(1.0,
+					alpha + static_cast<double>(first + (exact + l) * stride) * step);
+				er[l] = u.real();
+				ei[l] = u.imag();
+			}
+		const int m = (block % period) / lanes;
+		for (int l = 0; l < lanes; l++)
+		{
+			ur[l] = er[l] * rotation_re[m] - ei[l] * rotation_im[m];
+			ui[l] = er[l] * rotation_im[m] + ei[l] * rotation_re[m];
+		}
+		// z = r*u, 1/z = conj(u)/r; the numerators start at 1, the denominators at 1 - z
+		double zr[lanes], zi[lanes], vr[lanes], vi[lanes];
+		for (int l = 0; l < lanes; l++)
+		{
+			zr[l] = r * ur[l];
+			zi[l] = r * ui[l];
+			vr[l] = ur[l] / r;
+			vi[l] = -ui[l] / r;
+			nr[l] = 1.0;
+			ni[l] = 0.0;
+			dr[l] = 1.0 - zr[l];
+			di[l] = -zi[l];
+		}
+		if (real_q)
+			for (int n = 0; n < factors; n++)
+			{
+				const double p = power_re[n];
+				for (int l = 0; l < lanes; l++)
+				{	// numerator *= 1 + q^n/z, denominator *= 1 - q^n*z
+					const double ar = 1.0 + p * vr[l], ai = p * vi[l];
+					const double br = 1.0 - p * zr[l], bi = -p * zi[l];
+					const double x = nr[l], y = dr[l];
+					nr[l] = x * ar - ni[l] * ai;
+					ni[l] = x * ai + ni[l] * ar;
+					dr[l] = y * br - di[l] * bi;
+					di[l] = y * bi + di[l] * br;
+				}
+			}
+		else
+			for (int n = 0; n < factors; n++)
+			{
+				const double pr = power_re[n], pi = power_im[n];
+				for (int l = 0; l < lanes; l++)
+				{
+					const double ar = 1.0 + (pr * vr[l] - pi * vi[l]);
+					const double ai = pr * vi[l] + pi * vr[l];
+					const double br = 1.0 - (pr * zr[l] - pi * zi[l]);
+					const double bi = -(pr * zi[l] + pi * zr[l]);
+					const double x = nr[l], y = dr[l];
+					nr[l] = x * ar - ni[l] * ai;
+					ni[l] = x * ai + ni[l] * ar;
+					dr[l] = y * br - di[l] * bi;
+					di[l] = y * bi + di[l] * br;
+				}
+			}
+		for (int l = 0; l < lanes; l++)
+		{
+			const int i = block + l;
+			if (i < begin || i >= end)
+				continue;
+			const int k = first + i * stride;
+			const std::complex<double> denominator {dr[l], di[l]};
+			const std::complex<double> value = (is_subnormal(denominator) || !(r >= DBL_MIN))?
+				INFTY : std::complex<double>(nr[l], ni[l]) / denominator;
+			re[k * spacing] = value.real();
+			im[k * spacing] = value.imag();
+		}
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Computes the values number begin, ..., end-1 of the sequence from the infinite products,
+ * multiplying the factors until q^n underflows (the method `reference`).
+*/
+void tabulation::compute_reference(int begin, int end)
+{
+	const double alpha = startangle;
+	if (hbar.imag() == 0)
 	{   // Special case of real hbar, q and radius
-		double q = obj->q.real();
-		double r = obj->radius.real();
-		for (int k=0; k<len; k++)
+		const double q_real = q.real();
+		const double r = radius.real();
+		for (int i = begin; i < end; i++)
 		{
-			obj->buffer.push_back(
-						G_q<double>(q,
+			const int k = first + i * stride;
+			std::complex<double> value = G_q<double>(q_real,
 		/* z: */     std::polar<double>(r, alpha + (static_cast<double>(k) * step))
-								   )
-								 );
+								   );
+			re[k * spacing] = value.real();
+			im[k * spacing] = value.imag();
 		}
 	}
 	else
 	{   // General case of complex hbar; may be slower than otherwise
-		std::complex<double> q = obj->q;
-		std::complex<double> r = obj->radius;
-		for (int k=0; k<obj->length; k++)
+		for (int i = begin; i < end; i++)
 		{
-			obj->buffer.push_back(
-				G_q< std::complex<double> >(q,
-						r * std::polar<double>(1.0,
+			const int k = first + i * stride;
+			std::complex<double> value = G_q< std::complex<double> >(q,
+						radius * std::polar<double>(1.0,
 							alpha + (static_cast<double>(k) * step)
 											  )
-										   )
-								 );
+										   );
+			re[k * spacing] = value.real();
+			im[k * spacing] = value.imag();
 		}
 	}
 }
 // ------------------------------------------------------------------------------------------------
 /**
  * @brief
- * Retrieves the precomputed value at the given position.
- * There's a simple bounds check, so 'position' is essentially
- * reduced mod 'length' to yield a valid index.
+ * Returns exp(z) - 1 without the cancellation which occurs for small |z|
+ */
+static std::complex<double> expm1(std::complex<double> z)
+{
+	const double half_sine = std::sin(z.imag() / 2);
+	return {std::expm1(z.real()) * std::cos(z.imag()) - 2.0 * half_sine * half_sine,
+		std::exp(z.real()) * std::sin(z.imag())};
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Computes the values by the method `fft`, see tabulation.h.
+ * @return false if the sample points do not lie inside the annulus |q| < |z| < 1,
+ * or too close to its boundary, in which case nothing is computed.
+ * @remark
+ * The sample points are z_k = z_0 * w^k with w = exp(2*pi*i/length), so the terms of the
+ * Laurent series with z^m and z^(-m) contribute to the frequencies m and -m mod length
+ * of the sequence log G_q(z_k), which is then recovered by the inverse transform.
+ * The factors 1-q^m are computed as -expm1(m*hbar), which keeps them accurate when
+ * |q| is close to 1 and the products would need many factors.
+ */
+bool tabulation::laurent_circle()
+{
+	const double r = std::exp(log_start.real()); // the radius of the circle
+	const double rate = std::max(r, std::abs(q) / r); // the decay of the coefficients
+	if (!(rate < 1.0) || !(rate > 0.0))
+		return false;
+	// Coefficients below 1e-18 do not change the sum of the leading ones
+	const double terms = std::ceil(std::log(1e-18) / std::log(rate));
+	if (terms > MAX_LAURENT_TERMS)
+		return false;
+	std::vector< std::complex<double> > data(length, 0.0);
+	for (int m = 1; m <= static_cast<int>(terms); m++)
+	{
+		const double dm = static_cast<double>(m);
+		const std::complex<double> denominator = -dm * expm1(dm * hbar); // m(1-q^m)
+		const std::complex<double> positive = std::exp(dm * log_start) / denominator;
+		const std::complex<double> negative = std::exp(dm * (hbar - log_start)) / denominator;
+		data[m % length] += positive;
+		data[(length - m % length) % length] += (m % 2)? negative : -negative;
+	}
+	fft(data, true);
+	for (int k = first; k < length; k += stride)
+	{
+		const std::complex<double> value = std::exp(data[k]);
+		re[k * spacing] = value.real();
+		im[k * spacing] = value.imag();
+	}
+	return true;
+}
+// ================================================================================================
+/**
+ * @brief
+ * Adds a tabulation to the batch; see the constructor of the class tabulation
 */
-std::complex<double> tabulation::get(int position) const
-{ 
-	while (position > length)
-		position -= length;
-	while (position < 0)
-		position += length;
-	return buffer[position];
+void tabulation_batch::add(double initial_a, std::complex<double> hbar, int samples,
+	double* real_parts, double* imag_parts, int first_index, int index_stride,
+	int value_spacing, tabulation_method how)
+{
+	tables.emplace_back(initial_a, hbar, samples, real_parts, imag_parts, first_index,
+		index_stride, value_spacing, how);
 }
 // ------------------------------------------------------------------------------------------------
 /**
  * @brief
- * Waits for the precomputation thread to join before
- * returning control to the parent thread.
+ * Cuts the tabulations into chunks and launches the threads computing them
 */
-void tabulation::finish()
+void tabulation_batch::start()
 {
-	if (ready)
-		return;
-	if (iteration->joinable())
+	const unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	long long total = 0;
+	for (const tabulation& table : tables)
+		total += table.count();
+	// About CHUNKS_PER_THREAD chunks per thread, but not too short ones
+	const int length = static_cast<int>(std::max<long long>(MIN_CHUNK_LENGTH,
+		(total + CHUNKS_PER_THREAD * threads - 1) / (CHUNKS_PER_THREAD * threads)));
+	for (std::size_t t = 0; t < tables.size(); t++)
 	{
-		iteration->join();
-		ready = true;
+		const int count = tables[t].count();
+		const int step = tables[t].divisible()? length : count;
+		for (int begin = 0; begin < count; begin += step)
+			chunks.push_back({t, begin, std::min(begin + step, count)});
 	}
-	else
-		std::cerr << "Error in a precomputation thread!" << std::endl;
+	next_chunk = 0;
+	const std::size_t num_workers = std::min<std::size_t>(threads, chunks.size());
+	for (std::size_t w = 0; w < num_workers; w++)
+		workers.emplace_back(thread_main, this);
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * The thread main of the workers: computes chunks until none are left
+*/
+void tabulation_batch::thread_main(tabulation_batch* obj)
+{
+	for (std::size_t c = obj->next_chunk++; c < obj->chunks.size(); c = obj->next_chunk++)
+	{
+		const chunk& job = obj->chunks[c];
+		obj->tables[job.table].compute(job.begin, job.end);
+	}
+}
+// ------------------------------------------------------------------------------------------------
+/**
+ * @brief
+ * Waits for the worker threads to join before returning control to the parent thread.
+*/
+void tabulation_batch::finish()
+{
+	for (std::thread& worker : workers)
+	{
+		if (worker.joinable())
+			worker.join();
+		else
+			std::cerr << "Error in a precomputation thread!" << std::endl;
+	}
+	workers.clear();
+}
+// ------------------------------------------------------------------------------------------------
+tabulation_batch::~tabulation_batch()
+{
+	finish();
 }
 // ================================================================================================
 /*
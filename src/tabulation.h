@@ -6,55 +6,142 @@
 #ifndef __TABULATION_H__
 #define __TABULATION_H__
 
+#include <atomic>
 #include <thread>
 #include <vector>
 #include <complex>
 
 #include "transcendental.h"
 
+// How the values of G_q on a circle are computed, see the class tabulation below
+enum class tabulation_method {product, reference, fft};
+const char* tabulation_method_name(tabulation_method how);
+// Version of the values computed by the methods `product` and `fft`. It is recorded in
+// the cached tables, the checkpoints and the shards, and must be incremented whenever a
+// change of the code alters these values, even if only by rounding.
+constexpr int TABULATION_VERSION = 2;
+
 /**
  * @class
- * This class precomputes and stores the values of the factors G_q(w) at sample points of
+ * This class precomputes the values of the factors G_q(w) at sample points of
  * the form w = e^(alpha*hbar/pi) * z, with |z|=1.
  *
  * @remarks
- * Each tabulation object stores a single sequence of values, with z ranging over the
+ * Each tabulation object describes a single sequence of values, with z ranging over the
  * points exp(2*pi*i * k/samples) for k=0,1,...,samples-1, and where alpha and hbar are
- * fixed. The computation is launched by the class constructor, which allocates a buffer
- * storing the results. The buffer is implemented as std::vector. Thus, deallocation is 
- * done automatically by the defaulted class destructor.
+ * fixed. The real and imaginary parts of the results are written to the arrays passed to
+ * the constructor, which are owned by the caller (normally, they are planes of a
+ * table_arena). Optionally, only the values with k = first, first+stride, first+2*stride,
+ * ... are computed; the remaining entries of the arrays are left untouched. The value for
+ * k is stored at the index k*spacing of the arrays, which allows several tabulations to
+ * write to interleaved arrays. The values are computed by compute(), possibly in parts
+ * and by several threads at once; normally, this is arranged by a tabulation_batch.
+ *
+ * With the method `product`, every value is computed separately from the infinite
+ * product defining G_q, truncated after O(log(eps)/log|q|) factors. The number of factors
+ * is computed once per table by G_q_factors() so that the neglected factors change each
+ * value by a relative amount below PRODUCT_TOLERANCE = 1e-17 (see transcendental.cpp),
+ * and the products for several points are computed at once in SIMD lanes.
+ * The method `reference` multiplies the factors until q^n underflows, as G_q(q, z) does;
+ * this takes about 18 times as many factors. With the method `fft`,
+ * the Laurent coefficients of log G_q(z) in the annulus |q| < |z| < 1, which are
+ * z^m/(m(1-q^m)) and -(-q/z)^m/(m(1-q^m)), are summed into the frequencies of the
+ * samples on the circle, all values of the logarithm are obtained by a single FFT,
+ * and then exponentiated. This takes O(samples*log(samples)) operations plus one
+ * operation per significant coefficient. If the circle does not lie inside the annulus,
+ * the method `product` is used instead.
  * 
  * Other public member functions:
  *
- * std::complex<double> get(int position) - returns the tabulated value at the index
- *                                          given by 'position'. In other words, this value
- *                                          is G_q(e^(alpha*hbar/pi + 2*pi*i * k/samples)),
- *                                          where k=position.
+ * int count()                            - the number of values to compute.
+ *
+ * bool divisible()                       - whether the values may be computed in parts;
+ *                                          with the method `fft`, all of them are
+ *                                          computed at once.
  *
- * void finish()                          - finishes the tabulation. This function will
- *                                          block until the worker thread exits.
+ * void compute(begin, end)               - computes the values number begin, ...,
+ *                                          end-1 of the sequence, that is, those for
+ *                                          k = first + i*stride with begin <= i < end.
  *
  */
 
 class tabulation
 {
 	private:
-	std::vector<std::complex<double>> buffer; // buffer to store computed values
+	double* re;  // destination of the real parts
+	double* im;  // destination of the imaginary parts
 	std::complex<double> radius; // Stores the quantity exp(hbar * a)
 	std::complex<double> q; // the parameter q = exp(hbar)
+	std::complex<double> hbar; // the parameter hbar
+	std::complex<double> log_start; // the logarithm of the first sample point
 	double startangle;      // the initial angle
 	double step; // distance between consecutive sample points
 	int length;  // number of sample points
-	bool ready;  // whether the computation is done
-	std::unique_ptr<std::thread> iteration; // unique pointer to the thread object
+	int first;   // index of the first value to compute
+	int stride;  // distance between the indices of computed values
+	int spacing; // distance between consecutive values in the destination arrays
+	tabulation_method method; // how the values are computed
+	int factors; // number of factors of the truncated products
+	std::vector<double> power_re, power_im; // the powers q^n, n = 1, ..., factors
 
-	static void thread_main(tabulation* obj, bool real_q);
+	void compute_products(int begin, int end);
+	void compute_reference(int begin, int end);
+	bool laurent_circle();
 
 	public:
-	tabulation(double initial_a, std::complex<double> hbar, int samples);
+	tabulation(double initial_a, std::complex<double> hbar, int samples,
+		double* real_parts, double* imag_parts, int first_index = 0, int index_stride = 1,
+		int value_spacing = 1, tabulation_method how = tabulation_method::product);
 	~tabulation() = default;
-	std::complex<double> get(int position) const; // retrieves the stored value at 'position'
-	void finish(); // wait for the thread to join.
+	int count() const;
+	inline bool divisible() const {return method != tabulation_method::fft;}
+	void compute(int begin, int end);
+};
+
+/**
+ * @class
+ * This class computes a set of tabulations with a pool of threads.
+ *
+ * @remarks
+ * The tabulations are cut into chunks of consecutive values, which the threads take from
+ * a common counter, so that all of the threads are busy until the end regardless of the
+ * number of tables. The number of threads is the number of hardware threads (but not
+ * more than the number of chunks), and the chunks are small enough for every thread to
+ * get several of them. A tabulation which is not divisible (see above) forms one chunk.
+ *
+ * Public member functions:
+ *
+ * void add(...)                          - adds a tabulation; the arguments are those of
+ *                                          the constructor of the class tabulation.
+ *
+ * void start()                           - launches the threads; the function returns
+ *                                          immediately.
+ *
+ * void finish()                          - blocks until all of the values are computed.
+ *                                          The destructor calls it as well.
+ *
+ */
+class tabulation_batch
+{
+	private:
+	struct chunk {std::size_t table; int begin, end;};
+	std::vector<tabulation> tables;
+	std::vector<chunk> chunks;
+	std::vector<std::thread> workers;
+	std::atomic<std::size_t> next_chunk {0};
+
+	static void thread_main(tabulation_batch* obj);
+
+	public:
+	tabulation_batch() = default;
+	tabulation_batch(const tabulation_batch&) = delete;
+	tabulation_batch& operator=(const tabulation_batch&) = delete;
+	~tabulation_batch();
+	void add(double initial_a, std::complex<double> hbar, int samples,
+		double* real_parts, double* imag_parts, int first_index = 0, int index_stride = 1,
+		int value_spacing = 1, tabulation_method how = tabulation_method::product);
+	void start();
+	void finish();
 };
 
 #endif
@@ -4,6 +4,8 @@
  *   License information at the end of the file.
  */
 
+#include <algorithm>
+
 #include "transcendental.h"
 
 // =============================================================================================
@@ -81,6 +83,68 @@ CC c(q_t q) noexcept
 template CC c<double>(double q) noexcept;
 template CC c<CC>(CC q) noexcept;
 // =============================================================================================
+/*
+ * Returns the number of factors of an infinite product after which the remaining factors
+ * (1 + x_n) with |x_n| <= weight * |q|^n, n > factors, change the product by a relative
+ * amount of at most `tolerance`.
+ *
+ * The sum of the |x_n| over n > factors is at most S = weight * |q|^(factors+1) / (1-|q|).
+ * Since |log(1 + x)| <= |x|/(1 - |x|) and |exp(w) - 1| <= |w| exp(|w|), the relative
+ * change of the product is at most about S, and the number of factors is chosen so that
+ * S <= tolerance/2, which leaves room for the higher order terms.
+ */
+int product_factors(double abs_q, double weight, double tolerance) noexcept
+{
+	if (!(abs_q > 0.0) || !(abs_q < 1.0))
+		return 0;
+	const double bound = std::log(tolerance * (1.0 - abs_q) / (2.0 * weight)) / std::log(abs_q);
+	if (!(bound < 1e9))
+		return 1000000000;
+	return std::max(0, static_cast<int>(std::ceil(bound)) - 1);
+}
+// ---------------------------------------------------------------------------------------------
+/*
+ * The number of factors for G_q(z): the factors are (1 + q^n/z) in the numerator and
+ * 1/(1 - q^n z) in the denominator, so |x_n| <= |q|^n (1/|z| + |z|) up to higher order terms.
+ */
+int G_q_factors(double abs_q, double abs_z, double tolerance) noexcept
+{
+	return product_factors(abs_q, abs_z + 1.0/abs_z, tolerance);
+}
+// ---------------------------------------------------------------------------------------------
+/*
+ * The number of factors for c_q: the factors are (1 - q^n)^2 / (1 - q^2n),
+ * so |x_n| <= 3|q|^n up to higher order terms.
+ */
+int c_factors(double abs_q, double tolerance) noexcept
+{
+	return product_factors(abs_q, 3.0, tolerance);
+}
+// ---------------------------------------------------------------------------------------------
+/*
+ * Returns c_q computed from the factors with n <= factors; see c_factors().
+ */
+template<typename q_t>
+CC c(q_t q, int factors) noexcept
+{
+	static const CC one {1.0};
+	CC numerator   = one;
+	CC denominator = one;
+	CC q_to_n      = q;
+	for (int n = 1; n <= factors; n++)
+	{
+		numerator   *= square(one - q_to_n);
+		denominator *= one - square(q_to_n);
+		q_to_n      *= q;
+	}
+	if (is_subnormal(denominator))
+		return INFTY;
+	else
+		return numerator/denominator;
+}
+template CC c<double>(double q, int factors) noexcept;
+template CC c<CC>(CC q, int factors) noexcept;
+// =============================================================================================
 /*
  *
  * Copyright (C) 2019-2021 Rafael M. Siejakowski
@@ -12,6 +12,10 @@
 #include "constants.h"
 
 using CC = std::complex<double>;
+
+// The relative error allowed for the truncation of the infinite products; it is well
+// below the rounding errors of the products, which are at least DBL_EPSILON/2 = 1.1e-16
+constexpr double PRODUCT_TOLERANCE = 1e-17;
 /*
 	Here we declare the key functions G_q, c used for the
 	numerical evaluation of the transcendental functions G_q(z) and c_q.
@@ -22,6 +26,21 @@ CC G_q(q_t q, CC z) noexcept;
 template<typename q_t>
 CC c(q_t q) noexcept;
 
+/*
+	The variant with the argument `factors` multiplies only the factors of the infinite
+	product with n <= factors, where the number of factors is obtained from the function
+	product_factors() so that the neglected factors change the result by a relative
+	amount below a given tolerance. The function above serves as the reference. The
+	truncated products for G_q are computed by tabulation::compute_products(), with the
+	number of factors given by G_q_factors().
+*/
+template<typename q_t>
+CC c(q_t q, int factors) noexcept;
+
+int product_factors(double abs_q, double weight, double tolerance) noexcept;
+int G_q_factors(double abs_q, double abs_z, double tolerance = PRODUCT_TOLERANCE) noexcept;
+int c_factors(double abs_q, double tolerance = PRODUCT_TOLERANCE) noexcept;
+
 // Inline helper functions:
 inline CC square(CC z) {return z*z;};
 
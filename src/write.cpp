@@ -3,43 +3,371 @@
  *   All rights reserved.
  *   License information at the end of the file.
  */
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "kahan.h"
 #include "write.h"
 
 // =================================================================================================
-void store_integrand_values(Json::Value& target, mani_data& M, int samples)
+// Number of points evaluated and formatted at once by a thread (fewer for marginals, where
+// each value is a sum), and the number of blocks per thread which may be waiting to be
+// written (this bounds the memory usage)
+constexpr unsigned long long BLOCK_POINTS = 4096;
+constexpr unsigned long long BLOCKS_PER_THREAD = 4;
+// -------------------------------------------------------------------------------------------------
+static void append_indented(std::string& destination, const std::string& text,
+	const char* indentation)
 /*
-	This function fills 'target' with values of the meromorphic
-	3D-index integrand for M at sample points.
-	'samples' is the number of evenly spacesd sample points 
-	in each coordinate direction of the integration domain.
+	Appends 'text' to 'destination', inserting 'indentation' at the beginning of every line.
 */
 {
-	unsigned d =  M.num_tetrahedra() - M.num_cusps();    // dimension of integration domain
-	double step = twopi/static_cast<double>(samples);    // distance between adjacent samples
-	multi_iterator indices = multi_iterator(samples, d); // d-dimensional iterator
+	std::size_t begin = 0;
+	while (begin < text.size())
+	{
+		std::size_t end = text.find('\n', begin);
+		end = (end == std::string::npos)? text.size() : end + 1;
+		destination += indentation;
+		destination.append(text, begin, end - begin);
+		begin = end;
+	}
+}
+// -------------------------------------------------------------------------------------------------
+static std::complex<double> selected_value(const mani_data& M, int samples,
+	const sample_selection& selection, const std::vector<unsigned>& indices)
+/*
+	Returns the value of the integrand at the point with the given indices, including the
+	prefactor. If some axes are summed over, the indices along them are ignored, and the
+	mean of the values over these axes is returned instead, i.e., the Riemann sum of the
+	integral over the summed variables divided by (2*pi)^(number of summed axes); the mean
+	of these marginals over the remaining axes is the state integral.
+
+	The sum is computed as in integrator::odometer_sum(): the runs along the first summed
+	axis are evaluated in blocks by mani_data::get_integrand_block() and added by a
+	compensated KN_accumulator.
+*/
+{
+	const std::vector<unsigned>& summed = selection.summed_axes();
+	if (summed.empty())
+		return M.get_prefactor() * M.get_integrand_value(indices);
+	const int num_quads = static_cast<int>(M.num_quadrilaterals());
+	const long long S = samples;
+	auto reduce = [S](long long e) {return static_cast<int>(((e % S) + S) % S);};
+	// The exponents of the point with the summed indices equal to 0
+	std::vector<long long> base(num_quads, 0);
+	for (unsigned j = 0; j < selection.dimension(); j++)
+		if (selection.axis(j) != sample_selection::SUMMED)
+			for (int quad = 0; quad < num_quads; quad++)
+				base[quad] += static_cast<long long>(indices[j]) * M.ltd_entry(j, quad);
+	std::vector<int> run_increments(num_quads), exponents(num_quads);
+	for (int quad = 0; quad < num_quads; quad++)
+		run_increments[quad] = reduce(M.ltd_entry(summed[0], quad));
+
+	KN_accumulator sum;
+	double re[INTEGRAND_BLOCK], im[INTEGRAND_BLOCK];
+	multi_iterator outer = multi_iterator(samples, summed.size() - 1); // the other summed axes
 	do
 	{
-		Json::Value pts_array;
-		std::vector<unsigned> current_indices = indices.item();
-		std::complex<double> val = M.get_prefactor() * M.get_integrand_value(current_indices);
-		// compute actual coordinates of the sample point:
-		for (auto index : current_indices)
-			pts_array.append(step * static_cast<double>(index));
-		// Fill in a Json::Value point structure
-		Json::Value point;
-		point["t"] = pts_array;
-		if (val == INFTY)
+		for (int quad = 0; quad < num_quads; quad++)
+		{
+			long long e = base[quad];
+			for (std::size_t i = 1; i < summed.size(); i++)
+				e += static_cast<long long>(outer.item()[i-1]) * M.ltd_entry(summed[i], quad);
+			exponents[quad] = reduce(e);
+		}
+		for (unsigned done = 0; done < static_cast<unsigned>(samples); done += INTEGRAND_BLOCK)
+		{
+			const unsigned count = std::min(INTEGRAND_BLOCK, samples - done);
+			M.get_integrand_block(exponents.data(), run_increments.data(), count, re, im);
+			sum.add_block(re, im, count);
+		}
+	} while (outer.advance());
+	return M.get_prefactor() * std::complex<double>(sum)
+		/ static_cast<double>(selection.summands());
+}
+// -------------------------------------------------------------------------------------------------
+static unsigned long long block_points(const sample_selection& selection)
+/*
+	Returns the number of values in a block, such that a block sums about BLOCK_POINTS values
+	of the integrand.
+*/
+{
+	return std::max(1ull, BLOCK_POINTS / std::min(BLOCK_POINTS, selection.summands()));
+}
+// -------------------------------------------------------------------------------------------------
+static bool write_blocks(std::ostream& destination, unsigned long long count,
+	unsigned long long block_points,
+	const std::function<void(unsigned long long, unsigned long long, std::string&)>& format)
+/*
+	Writes the text of the points 0, 1, ..., count-1 to 'destination', in this order.
+	The points are divided into blocks of 'block_points' consecutive points; the call
+	format(begin, end, text) stores the text of the points begin, ..., end-1 in 'text'.
+
+	The blocks are formatted by a pool of threads, which take them in increasing order,
+	while the calling thread writes the finished blocks in order, so that the output does
+	not depend on the number of threads and the writing overlaps with the computation.
+	At most BLOCKS_PER_THREAD blocks per thread are formatted but not yet written.
+	Returns false if writing fails.
+*/
+{
+	const unsigned long long num_blocks = (count + block_points - 1) / block_points;
+	const unsigned threads = static_cast<unsigned>(std::max(1ull, std::min(num_blocks,
+		static_cast<unsigned long long>(std::thread::hardware_concurrency()))));
+	const unsigned long long window = BLOCKS_PER_THREAD * threads;
+	std::vector<std::string> slots(window); // the text of block b is in slots[b % window]
+	std::vector<bool> ready(window, false);
+	std::mutex lock;
+	std::condition_variable changed;
+	unsigned long long next_block = 0; // the next block to be formatted
+	unsigned long long written = 0;    // the number of blocks written
+	bool failed = false;
+
+	auto worker = [&]()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		while (true)
+		{
+			changed.wait(guard, [&]{return failed || next_block < written + window;});
+			if (failed || next_block >= num_blocks)
+				return;
+			const unsigned long long block = next_block++;
+			guard.unlock();
+			std::string text;
+			format(block * block_points, std::min(count, (block + 1) * block_points), text);
+			guard.lock();
+			slots[block % window].swap(text);
+			ready[block % window] = true;
+			changed.notify_all();
+		}
+	};
+	std::vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; t++)
+		workers.emplace_back(worker);
+
+	for (unsigned long long block = 0; block < num_blocks; block++)
+	{
+		std::string text;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			changed.wait(guard, [&]{return static_cast<bool>(ready[block % window]);});
+			text.swap(slots[block % window]);
+			ready[block % window] = false;
+		}
+		destination.write(text.data(), static_cast<std::streamsize>(text.size()));
+		std::lock_guard<std::mutex> guard(lock);
+		written = block + 1;
+		failed = !destination;
+		changed.notify_all();
+		if (failed)
+			break;
+	}
+	for (auto& thread : workers)
+		thread.join();
+	return !failed;
+}
+// -------------------------------------------------------------------------------------------------
+bool write_integrand_values(std::ostream& destination, const Json::Value& input,
+	const mani_data& M, int samples, const sample_selection& selection)
+/*
+	This function writes the JSON object with the keys "input" and "output" to 'destination',
+	where "output" contains the values of the meromorphic 3D-index integrand for M at sample
+	points. 'samples' is the number of evenly spacesd sample points in each coordinate
+	direction of the integration domain, and 'selection' determines which of them are
+	written (or summed over, in which case "t" contains only the remaining coordinates).
+
+	The result is the same text that print_json() would produce for the whole object. It is
+	assembled from the serializations of 'input' and of each point, which are made by the
+	same JSON writer and indented as they would be inside the object, so that only the
+	blocks of points being processed by write_blocks() are held in memory.
+	Returns false if writing fails.
+*/
+{
+	Json::StreamWriterBuilder builder;
+	builder["indentation"] = "\t";
+	builder.settings_["precision"] = 320;
+	std::ostringstream input_text;
+	std::unique_ptr<Json::StreamWriter>(builder.newStreamWriter())->write(input, &input_text);
+	std::string header = "{\n\t\"input\" : \n";
+	append_indented(header, input_text.str(), "\t");
+	header += ",\n\t\"output\" : \n\t{\n\t\t\"points\" : \n\t\t[\n";
+	destination << header;
+
+	const unsigned d = selection.dimension();             // dimension of integration domain
+	double step = twopi/static_cast<double>(samples);    // distance between adjacent samples
+	auto format = [&](unsigned long long begin, unsigned long long end, std::string& text)
+	{
+		std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+		std::ostringstream point_text;
+		// iterator over the free axes
+		multi_iterator free_indices = multi_iterator(selection.extent(),
+			selection.free_axes().size());
+		free_indices.seek(begin);
+		std::vector<unsigned> current_indices(d, 0);
+		Json::Value point, coordinates(Json::arrayValue);
+		coordinates.resize(d - selection.summed_axes().size());
+		for (unsigned long long position = begin; position < end;
+			position++, free_indices.advance())
 		{
-			point["real"] = "infinity";
-			point["imag"] = "infinity";
+			selection.locate(free_indices.item(), current_indices);
+			std::complex<double> val = selected_value(M, samples, selection, current_indices);
+			// compute actual coordinates of the sample point (without the summed axes):
+			for (unsigned i = 0, j = 0; i < d; i++)
+				if (selection.axis(i) != sample_selection::SUMMED)
+					coordinates[j++] = step * static_cast<double>(current_indices[i]);
+			// Fill in a Json::Value point structure
+			point["t"] = coordinates;
+			if (val == INFTY)
+			{
+				point["real"] = "infinity";
+				point["imag"] = "infinity";
+			}
+			else
+			{
+				point["real"] = val.real();
+				point["imag"] = val.imag();
+			}
+			if (position > 0)
+				text += ",\n";
+			point_text.str("");
+			writer->write(point, &point_text);
+			append_indented(text, point_text.str(), "\t\t\t");
 		}
-		else
+	};
+	if (!write_blocks(destination, selection.count(), block_points(selection), format))
+		return false;
+	destination << "\n\t\t]\n\t}\n}" << std::endl;
+	return static_cast<bool>(destination);
+}
+// -------------------------------------------------------------------------------------------------
+static bool little_endian()
+/*
+	Returns true if the machine stores numbers with the least significant byte first.
+*/
+{
+	const unsigned short probe = 1;
+	return *reinterpret_cast<const unsigned char*>(&probe) == 1;
+}
+// -------------------------------------------------------------------------------------------------
+static std::string array_shape(const sample_selection& selection)
+/*
+	Returns the shape of the array of values as a Python tuple, e.g. "(100, 100)".
+*/
+{
+	const std::size_t d = selection.free_axes().size();
+	std::string shape = "(";
+	for (std::size_t i = 0; i < d; i++)
+		shape += std::to_string(selection.extent()) + ((i + 1 < d || d == 1)? "," : "")
+			+ ((i + 1 < d)? " " : "");
+	return shape + ")";
+}
+// -------------------------------------------------------------------------------------------------
+bool write_integrand_array(std::ostream& destination, const mani_data& M, int samples,
+	const sample_selection& selection, bool npy_header)
+/*
+	This function writes the selected values of the integrand to 'destination' as an array
+	of complex numbers, each of which is a pair of doubles (the real and the imaginary part)
+	in the byte order of the machine. The array has one axis for each free axis of the
+	selection, of length selection.extent(). The value at the point with the indices
+	(i_1, ..., i_d) along the free axes is the element (i_1, ..., i_d) of the array in
+	Fortran (column-major) order, i.e., i_1 changes fastest; this is the order of the points
+	in the JSON output. Without a selection, the shape is (samples, ..., samples).
+	Poles are written as inf+inf*i.
+
+	If 'npy_header' is true, the array is preceded by the header of a NumPy .npy file
+	(version 1.0) with the dtype complex128 and fortran_order True, so that the file can be
+	loaded or memory-mapped by numpy.load. The data is computed by several threads and
+	written sequentially in blocks by write_blocks(). Returns false if writing fails.
+*/
+{
+	if (npy_header)
+	{
+		std::string header = std::string("{'descr': '") + (little_endian()? "<" : ">")
+			+ "c16', 'fortran_order': True, 'shape': " + array_shape(selection) + ", }";
+		// The magic string, the version, the header length, the header and the
+		// terminating newline take a multiple of 64 bytes, as recommended
+		const std::size_t unpadded = 10 + header.size() + 1;
+		header.append((64 - unpadded % 64) % 64, ' ');
+		header.push_back('\n');
+		const unsigned short length = static_cast<unsigned short>(header.size());
+		const char preamble[10] = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0,
+			static_cast<char>(length & 0xff), static_cast<char>(length >> 8)};
+		destination.write(preamble, sizeof(preamble));
+		destination << header;
+	}
+	auto format = [&](unsigned long long begin, unsigned long long end, std::string& text)
+	{
+		std::vector<double> values;
+		values.reserve(2 * (end - begin));
+		// iterator over the free axes
+		multi_iterator free_indices = multi_iterator(selection.extent(),
+			selection.free_axes().size());
+		free_indices.seek(begin);
+		std::vector<unsigned> indices(selection.dimension(), 0);
+		for (unsigned long long position = begin; position < end;
+			position++, free_indices.advance())
 		{
-			point["real"] = val.real();
-			point["imag"] = val.imag();
+			selection.locate(free_indices.item(), indices);
+			std::complex<double> val = selected_value(M, samples, selection, indices);
+			if (!std::isfinite(val.real()) || !std::isfinite(val.imag()))
+				val = {std::numeric_limits<double>::infinity(),
+					std::numeric_limits<double>::infinity()};
+			values.push_back(val.real());
+			values.push_back(val.imag());
 		}
-		target["points"].append(point); 
-	} while (indices.advance());
+		text.assign(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+	};
+	if (!write_blocks(destination, selection.count(), block_points(selection), format))
+		return false;
+	destination.flush();
+	return static_cast<bool>(destination);
+}
+// -------------------------------------------------------------------------------------------------
+void describe_integrand_array(Json::Value& target, const sample_selection& selection)
+/*
+	This function fills 'target' with the description of the array written by
+	write_integrand_array, which is stored in the sidecar file. The axes of the
+	integration domain are numbered from 1, as in the options of the write mode.
+*/
+{
+	Json::Value shape(Json::arrayValue), axes(Json::arrayValue);
+	for (unsigned axis : selection.free_axes())
+	{
+		shape.append(selection.extent());
+		axes.append(axis + 1);
+	}
+	target["shape"] = shape;
+	target["axes"] = axes;
+	target["dtype"] = "complex128";
+	target["byte order"] = little_endian()? "little" : "big";
+	target["order"] = "F";
+	if (selection.decimation_factor() > 1)
+		target["decimation"] = selection.decimation_factor();
+	Json::Value fixed(Json::objectValue);
+	for (unsigned j = 0; j < selection.dimension(); j++)
+		if (selection.axis(j) >= 0)
+			fixed[std::to_string(j + 1)] = selection.axis(j);
+	if (!fixed.empty())
+		target["fixed indices"] = fixed;
+	if (!selection.summed_axes().empty())
+	{
+		Json::Value summed(Json::arrayValue);
+		for (unsigned axis : selection.summed_axes())
+			summed.append(axis + 1);
+		target["summed axes"] = summed;
+	}
+	target["t"] = (selection.decimation_factor() > 1)?
+		"t_a = 2*pi*decimation*i/samples, where i is the index along the array axis of the "
+		"axis a in 'axes'" : "t_a = 2*pi*i/samples, where i is the index along the array "
+		"axis of the axis a in 'axes'";
 }
 // =================================================================================================
 /*
@@ -50,7 +378,20 @@ multi_iterator::multi_iterator(unsigned length, unsigned depth)
 /*
 	Class constructor
 */
-: len {length}, d {depth}, buffer {depth, 0} {}
+: len {length}, d {depth}, buffer(depth, 0) {}
+// -------------------------------------------------------------------------------------------------
+void multi_iterator::seek(unsigned long long position)
+/*
+	Moves the iterator to the given position in the order of iteration,
+	in which the first index changes fastest.
+*/
+{
+	for (unsigned pos = 0; pos < d; pos++)
+	{
+		buffer[pos] = static_cast<unsigned>(position % len);
+		position /= len;
+	}
+}
 // -------------------------------------------------------------------------------------------------
 bool multi_iterator::advance()
 /*
@@ -71,6 +412,121 @@ bool multi_iterator::advance()
 	return true;
 }
 // =================================================================================================
+/*
+	Implementation of member functions of class sample_selection
+*/
+// =================================================================================================
+sample_selection::sample_selection(unsigned dimension, unsigned num_samples)
+/*
+	Class constructor; all of the axes are free and all of the indices are taken
+*/
+: samples {num_samples}, decimation {1}, axes(dimension, FREE)
+{
+	for (unsigned j = 0; j < dimension; j++)
+		free.push_back(j);
+}
+// -------------------------------------------------------------------------------------------------
+bool sample_selection::restrict(const std::vector<int>& slice, unsigned decimation_factor,
+	const std::vector<int>& marginal)
+/*
+	Applies the options of the write mode: 'slice' has one entry for each axis, either a
+	fixed index or -1 for a free axis; 'marginal' lists the axes which are kept (numbered
+	from 1), the others being summed over. Either of them may be empty.
+	Returns false and prints a message if the options do not fit the integration domain.
+*/
+{
+	const unsigned d = axes.size();
+	if (!slice.empty())
+	{
+		if (slice.size() != d)
+		{
+			std::cerr << "Error: the slice must have one entry for each of the " << d
+				<< " axes!" << std::endl;
+			return false;
+		}
+		for (unsigned j = 0; j < d; j++)
+		{
+			if (slice[j] >= static_cast<int>(samples))
+			{
+				std::cerr << "Error: the index " << slice[j] << " of the slice is not less "
+					"than the number of samples!" << std::endl;
+				return false;
+			}
+			axes[j] = (slice[j] < 0)? FREE : slice[j];
+		}
+	}
+	if (!marginal.empty())
+	{
+		std::fill(axes.begin(), axes.end(), SUMMED);
+		for (int axis : marginal)
+		{
+			if (axis < 1 || axis > static_cast<int>(d) || axes[axis-1] == FREE)
+			{
+				std::cerr << "Error: the axes kept by the marginal must be distinct numbers "
+					"from 1 to " << d << "!" << std::endl;
+				return false;
+			}
+			axes[axis-1] = FREE;
+		}
+	}
+	decimation = decimation_factor;
+	free.clear();
+	summed.clear();
+	for (unsigned j = 0; j < d; j++)
+	{
+		if (axes[j] == FREE)
+			free.push_back(j);
+		else if (axes[j] == SUMMED)
+			summed.push_back(j);
+	}
+	return true;
+}
+// -------------------------------------------------------------------------------------------------
+unsigned sample_selection::extent() const
+/*
+	Returns the number of indices 0, k, 2k, ... below the number of samples,
+	where k is the decimation factor.
+*/
+{
+	return (samples + decimation - 1) / decimation;
+}
+// -------------------------------------------------------------------------------------------------
+unsigned long long sample_selection::count() const
+/*
+	Returns the number of values written, extent()^(number of free axes).
+*/
+{
+	unsigned long long result = 1;
+	for (std::size_t i = 0; i < free.size(); i++)
+		result *= extent();
+	return result;
+}
+// -------------------------------------------------------------------------------------------------
+unsigned long long sample_selection::summands() const
+/*
+	Returns the number of points summed for each value, samples^(number of summed axes).
+*/
+{
+	unsigned long long result = 1;
+	for (std::size_t i = 0; i < summed.size(); i++)
+		result *= samples;
+	return result;
+}
+// -------------------------------------------------------------------------------------------------
+void sample_selection::locate(const std::vector<unsigned>& free_indices,
+	std::vector<unsigned>& indices) const
+/*
+	Stores in 'indices' the indices of the point whose indices along the free axes are
+	the elements of 'free_indices' (counted in steps of the decimation factor); the
+	indices along the summed axes are set to 0.
+*/
+{
+	for (std::size_t j = 0; j < axes.size(); j++)
+		indices[j] = (axes[j] >= 0)? static_cast<unsigned>(axes[j]) : 0;
+	for (std::size_t i = 0; i < free.size(); i++)
+		indices[free[i]] = free_indices[i] * decimation;
+}
+// =================================================================================================
 /*
  *
  * Copyright (C) 2019-2021 Rafael M. Siejakowski
@@ -6,27 +6,42 @@
 #ifndef __WRITE_H__
 #define __WRITE_H__
 
-#include <fstream>
+#include <ostream>
 #include <vector>
 #include <json/json.h>
 #include "manifold.h"
 #include "constants.h"
 
 /*
-	This file declares the class multi_iterator and
-	the function store_integrand_values.
-	Both of them are specific to the 'write' mode.
+	This file declares the classes multi_iterator and sample_selection
+	and the functions write_integrand_values and write_integrand_array.
+	All of them are specific to the 'write' mode.
 
 	class multi_iterator is a simple iterator which
 	iterates over the set [0,1,...,s-1]^d,
 	where d and s are arbitrary positive integers.
+
+	class sample_selection describes which values are written: each
+	axis of the integration domain is either free, taking the indices
+	0, k, 2k, ... below the number of samples, where k is the decimation
+	factor; or fixed at a given index (a slice); or summed over, so that
+	the values are the marginals of the integrand in the other variables.
+	The values are written for all of the combinations of the indices
+	of the free axes, the first free axis changing fastest.
 	
-	store_integrand_values computes the values of the integrand
+	write_integrand_values computes the values of the integrand
 	of the meromorphic 3D-index at sample points with prescribed
-	density and stores them in a Json::Value data structure.
-*/
+	density and writes them as JSON data to a stream, one point
+	at a time, so that the memory usage does not depend on the
+	number of points. The points are evaluated and formatted by
+	several threads in blocks, which are written in order.
 
-void store_integrand_values(Json::Value& target, mani_data& M, int samples);
+	write_integrand_array writes the same values as a dense array
+	of complex numbers (pairs of doubles in the byte order of the
+	machine), optionally preceded by the header of a NumPy .npy
+	file; describe_integrand_array fills a JSON object describing
+	that array for the sidecar file.
+*/
 
 class multi_iterator
 {
@@ -36,10 +51,43 @@ class multi_iterator
 	std::vector<unsigned int> buffer; // buffer to store the current indices
 	public:
 	multi_iterator(unsigned int length, unsigned int depth);
-	inline std::vector<unsigned int> item() {return buffer;};
+	inline const std::vector<unsigned int>& item() const {return buffer;};
+	void seek(unsigned long long position);
 	bool advance();
 };
 
+class sample_selection
+{
+	public:
+	static constexpr int FREE = -1;   // the axis is free
+	static constexpr int SUMMED = -2; // the axis is summed over
+	private:
+	unsigned samples;           // number of samples in each direction
+	unsigned decimation;        // distance between the indices taken along the free axes
+	std::vector<int> axes;      // for each axis: FREE, SUMMED or the fixed index
+	std::vector<unsigned> free; // the free axes, in increasing order
+	std::vector<unsigned> summed; // the axes summed over, in increasing order
+	public:
+	sample_selection(unsigned dimension, unsigned num_samples);
+	bool restrict(const std::vector<int>& slice, unsigned decimation,
+		const std::vector<int>& marginal);
+	unsigned extent() const; // number of indices taken along each free axis
+	unsigned long long count() const; // number of values written
+	unsigned long long summands() const; // number of points summed for each value
+	inline const std::vector<unsigned>& free_axes() const {return free;}
+	inline const std::vector<unsigned>& summed_axes() const {return summed;}
+	inline unsigned decimation_factor() const {return decimation;}
+	inline int axis(unsigned j) const {return axes[j];}
+	inline unsigned dimension() const {return axes.size();}
+	void locate(const std::vector<unsigned>& free_indices, std::vector<unsigned>& indices) const;
+};
+
+bool write_integrand_values(std::ostream& destination, const Json::Value& input,
+	const mani_data& M, int samples, const sample_selection& selection);
+bool write_integrand_array(std::ostream& destination, const mani_data& M, int samples,
+	const sample_selection& selection, bool npy_header);
+void describe_integrand_array(Json::Value& target, const sample_selection& selection);
+
 #endif
 
 /*
@@ -0,0 +1,91 @@
+#!/usr/bin/python
+#
+# (C) Copyright 2018-2021 by Rafael M. Siejakowski
+# All rights reserved.
+#
+# License information at the end of the file.
+#
+###############################################################################
+#
+# This is a Python script for checking that the run-time generated kernel
+# (`--kernel jit`) of `m3di` gives the same results as the built-in kernels,
+# in particular on the refined grids of `--tol`, whose cosets have offsets
+# depending on the LTD matrix. Small sample counts are used, so that the
+# entries of the LTD matrix often differ by multiples of the sample count.
+#
+# Usage: check_jit.py [path to m3di] [path to the census directory]
+#
+###############################################################################
+try:
+    import json
+    import subprocess
+    import sys
+except ImportError:
+    print("Error! Could not import one of the required packages.")
+
+MANIFOLDS = ["m003", "m004", "m009", "m015"]
+CASES = [
+    ["-0.3", "0.1", "4", "--tol", "0.5"],
+    ["-0.3", "0.1", "6", "--tol", "0.1"],
+    ["-0.2", "0", "8", "--tol", "0.01"],
+    ["-0.3", "0.1", "16"],
+]
+
+def run(m3di, manifold, case, kernel):
+    """
+    Runs the integrate mode of `m3di` with the given kernel and returns
+    the output part of its JSON result, or None in case of error.
+    """
+    command = [m3di, "integrate", manifold] + case + ["--kernel", kernel]
+    try:
+        result = subprocess.run(command, stdout=subprocess.PIPE, check=True)
+        return json.loads(result.stdout)['output']
+    except (OSError, subprocess.CalledProcessError, ValueError, KeyError):
+        print(f"Error: the command '{' '.join(command)}' failed!")
+        return None
+#end
+
+def main():
+    m3di = sys.argv[1] if len(sys.argv) > 1 else "build/m3di"
+    census = sys.argv[2] if len(sys.argv) > 2 else "census"
+    failures = 0
+
+    for name in MANIFOLDS:
+        manifold = f"{census}/{name}.json"
+        for case in CASES:
+            builtin = run(m3di, manifold, case, "builtin")
+            jit = run(m3di, manifold, case, "jit")
+            if builtin is None or jit is None or builtin != jit:
+                print(f"MISMATCH {name} {' '.join(case)}: {builtin} != {jit}")
+                failures += 1
+            else:
+                print(f"ok       {name} {' '.join(case)}")
+
+    print(f"{failures} mismatch(es).")
+    return 1 if failures else 0
+#end
+
+if __name__ == "__main__":
+    sys.exit(main())
+#end
+
+###############################################################################
+#
+# Copyright (C) 2018-2021 Rafael M. Siejakowski
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# version 2 as published by the Free Software Foundation;
+# later versions of the GNU General Public Licence do NOT apply.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+# 02110-1301, USA.
+#
+###############################################################################
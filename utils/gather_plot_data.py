@@ -75,9 +75,34 @@ def process_json(json_filepath):
     return pair
 #end  
 
+def process_jsonl(jsonl_filepath):
+    """
+    Opens a JSON Lines file created by `m3di sweep` and returns
+    the list of pairs (kappa, I(kappa)) extracted from its lines.
+    Lines which cannot be processed are skipped.
+    """
+    pairs = []
+    try:
+        file_handle = open(jsonl_filepath, "r")
+    except IOError:
+        print(f"Error: cannot open file '{jsonl_filepath}' for reading!")
+        return pairs
+
+    for line in file_handle:
+        if not line.strip():
+            continue
+        try:
+            pairs.append(extract_pair(json.loads(line)))
+        except (JsonError, ValueError):
+            print(f"Error: a line of '{jsonl_filepath}' doesn't have the expected format!")
+    file_handle.close()
+    return pairs
+#end
+
 def gather_jsons(directory):
     """
     Extracts the pairs (kappa, I(kappa)) from all JSON files
+    and JSON Lines files (the output of `m3di sweep`)
     in the given directory, puts them into a list, and returns
     a string containing a Python assignment instruction which
     puts this list into a variable `out`.
@@ -90,6 +115,8 @@ def gather_jsons(directory):
     # Process all JSON files matching the regexp:
     for file in glob.glob(wildcard):
         points.append(process_json(file))
+    for file in glob.glob(directory + '*.jsonl'):
+        points.extend(process_jsonl(file))
     # We sort the points by the kappa coordinate
     points.sort(key=lambda p: p[0])
     serialized = repr(points).replace("), ", "),\n       ") #nicer indents
@@ -117,7 +144,8 @@ def print_usage(myself):
     Prints a help string about the script and how to use it.
     """
     print(f"\nUsage:\n\t{myself} <Directory> <Output>\n")
-    print("Reads all JSON files (with extension *.json) in the given <Directory>\n"
+    print("Reads all JSON files (with extension *.json) and JSON Lines files\n"
+          "(with extension *.jsonl, as written by `m3di sweep`) in the given <Directory>\n"
           "and records the values input.hbar_real and output.real found in these\n"
           "files. After converting each value of hbar to kappa := -1/hbar, a new\n"
           "list is written to the <Output> file.  This list consists of pairs of\n"